@@ -0,0 +1,233 @@
+/*
+
+smtp_submit.cpp
+---------------
+
+Measures the throughput of the SMTP submission against the loopback mock server, for small, large and many-recipient messages.
+
+Usage: smtp_submit [iterations_scale]
+
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <mailio/message.hpp>
+#include <mailio/smtp.hpp>
+
+
+using std::string;
+using std::to_string;
+using std::function;
+using std::thread;
+using std::cout;
+using std::endl;
+using std::setw;
+using std::fixed;
+using std::setprecision;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using boost::asio::io_context;
+using boost::asio::ip::tcp;
+using boost::asio::streambuf;
+using boost::asio::read_until;
+using boost::asio::write;
+using boost::asio::buffer;
+using boost::istarts_with;
+using boost::to_upper_copy;
+using mailio::message;
+using mailio::formatted_message;
+using mailio::mime;
+using mailio::mail_address;
+using mailio::smtp;
+using mailio::smtp_error;
+using mailio::dialog_error;
+
+
+/**
+SMTP sink accepting everything, serving one connection at a time on the loopback interface.
+
+It speaks `EHLO`, `AUTH`, `MAIL`, `RCPT`, `DATA`, `RSET` and `QUIT`, and advertises `PIPELINING` and `SIZE` without enforcing them.
+**/
+class mock_smtp_server
+{
+public:
+
+    mock_smtp_server() : acceptor_(ioc_, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0))
+    {
+        thread_ = thread([this]() { serve(); });
+    }
+
+    ~mock_smtp_server()
+    {
+        thread_.join();
+    }
+
+    unsigned port() const
+    {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+
+    void serve()
+    {
+        tcp::socket socket(ioc_);
+        acceptor_.accept(socket);
+        streambuf buf;
+        auto reply = [&socket](const string& line) { write(socket, buffer(line + "\r\n")); };
+        auto receive = [&socket, &buf](const string& delim)
+        {
+            std::size_t n = read_until(socket, buf, delim);
+            string line(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_begin(buf.data()) + n - delim.length());
+            buf.consume(n);
+            return line;
+        };
+
+        reply("220 localhost mock SMTP");
+        while (true)
+        {
+            string line = receive("\r\n");
+            string cmd = to_upper_copy(line.substr(0, 4));
+            if (cmd == "EHLO")
+            {
+                reply("250-localhost");
+                reply("250-PIPELINING");
+                reply("250-SIZE 104857600");
+                reply("250 AUTH PLAIN LOGIN");
+            }
+            else if (cmd == "HELO")
+                reply("250 localhost");
+            else if (istarts_with(line, "AUTH LOGIN"))
+            {
+                reply("334 VXNlcm5hbWU6");
+                receive("\r\n");
+                reply("334 UGFzc3dvcmQ6");
+                receive("\r\n");
+                reply("235 Authentication successful");
+            }
+            else if (cmd == "AUTH")
+                reply("235 Authentication successful");
+            else if (cmd == "MAIL" || cmd == "RCPT" || cmd == "RSET" || cmd == "NOOP")
+                reply("250 OK");
+            else if (cmd == "DATA")
+            {
+                reply("354 End data with <CR><LF>.<CR><LF>");
+                receive("\r\n.\r\n");
+                reply("250 OK queued");
+            }
+            else if (cmd == "QUIT")
+            {
+                reply("221 Bye");
+                break;
+            }
+            else
+                reply("502 Command not implemented");
+        }
+    }
+
+    io_context ioc_;
+    tcp::acceptor acceptor_;
+    thread thread_;
+};
+
+
+/**
+Submitting the given number of messages on a single connection and printing the throughput.
+**/
+void run(const string& name, unsigned iterations, const function<void(smtp&)>& submit, std::size_t msg_size)
+{
+    mock_smtp_server server;
+    smtp conn("127.0.0.1", server.port());
+    conn.start_tls(false);
+    conn.ssl_options(std::nullopt);
+    conn.authenticate("mailio", "mailio", smtp::auth_method_t::PLAIN);
+
+    auto begin = steady_clock::now();
+    for (unsigned i = 0; i < iterations; i++)
+        submit(conn);
+    double secs = duration<double>(steady_clock::now() - begin).count();
+
+    cout << std::left << setw(24) << name << std::right << setw(8) << iterations << setw(14) << fixed << setprecision(1) << iterations / secs
+        << setw(14) << setprecision(2) << iterations * msg_size / secs / 1048576.0 << endl;
+}
+
+
+message make_message(unsigned recipients, std::size_t attachment_size)
+{
+    message msg;
+    msg.from(mail_address("mailio library", "mailio@mailio.dev"));
+    for (unsigned r = 0; r < recipients; r++)
+        msg.add_recipient(mail_address("recipient " + to_string(r), "rcpt" + to_string(r) + "@mailio.dev"));
+    msg.subject("smtp submit benchmark");
+    if (attachment_size == 0)
+    {
+        msg.content(string(1024, 'a'));
+        return msg;
+    }
+
+    msg.content_type(message::media_type_t::MULTIPART, "mixed");
+    msg.content_type().boundary("bench_boundary");
+    msg.content("Hello, World!");
+    mime att;
+    att.content_type(message::media_type_t::APPLICATION, "octet-stream");
+    att.content_transfer_encoding(mime::content_transfer_encoding_t::BASE_64);
+    att.content_disposition(mime::content_disposition_t::ATTACHMENT);
+    string content(attachment_size, '\0');
+    for (std::size_t i = 0; i < attachment_size; i++)
+        content[i] = static_cast<char>(i * 7919 % 256);
+    att.content(content);
+    msg.add_part(att);
+    return msg;
+}
+
+
+int main(int argc, char* argv[])
+{
+    unsigned scale = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1;
+    try
+    {
+        cout << std::left << setw(24) << "scenario" << std::right << setw(8) << "msgs" << setw(14) << "msgs/s" << setw(14) << "MiB/s" << endl;
+
+        message small = make_message(1, 0);
+        formatted_message small_fmt(small);
+        run("small", 2000 * scale, [&small](smtp& conn) { conn.submit(small); }, small_fmt.size());
+        run("small preformatted", 2000 * scale, [&small_fmt](smtp& conn) { conn.submit(small_fmt); }, small_fmt.size());
+
+        message large = make_message(1, 5 * 1048576);
+        formatted_message large_fmt(large);
+        run("large 5MiB", 10 * scale, [&large](smtp& conn) { conn.submit(large); }, large_fmt.size());
+        run("large 5MiB preformatted", 10 * scale, [&large_fmt](smtp& conn) { conn.submit(large_fmt); }, large_fmt.size());
+
+        message many = make_message(500, 0);
+        formatted_message many_fmt(many);
+        run("500 recipients", 50 * scale, [&many](smtp& conn) { conn.submit(many); }, many_fmt.size());
+    }
+    catch (smtp_error& exc)
+    {
+        cout << exc.what() << endl;
+        return EXIT_FAILURE;
+    }
+    catch (dialog_error& exc)
+    {
+        cout << exc.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+/*
+
+lmtp_deliver.cpp
+----------------
+
+Connects to a local LMTP server and delivers a message to several mailboxes, reporting the delivery status of each one.
+
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#include <iostream>
+#include <mailio/message.hpp>
+#include <mailio/smtp.hpp>
+
+
+using mailio::message;
+using mailio::mail_address;
+using mailio::smtp;
+using mailio::lmtp;
+using mailio::smtp_error;
+using mailio::dialog_error;
+using std::cout;
+using std::endl;
+
+
+int main()
+{
+    try
+    {
+        // create mail message
+        message msg;
+        msg.from(mail_address("mailio library", "mailio@mailio.dev"));// set the correct sender name and address
+        msg.add_recipient(mail_address("mailio library", "mailio@mailio.dev"));// set the correct recipent names and addresses
+        msg.add_recipient(mail_address("mailio library", "contact@mailio.dev"));
+        msg.subject("lmtp delivered message");
+        msg.content("Hello, World!");
+
+        // connect to server over plain tcp
+        lmtp conn("localhost", 24);
+        conn.start_tls(false);
+        conn.ssl_options(std::nullopt);
+        conn.authenticate("", "", smtp::auth_method_t::NONE);
+        for (const auto& rcpt : conn.submit(msg))
+            cout << rcpt.address << ": " << rcpt.status << " " << rcpt.response << endl;
+    }
+    catch (smtp_error& exc)
+    {
+        cout << exc.what() << endl;
+    }
+    catch (dialog_error& exc)
+    {
+        cout << exc.what() << endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -31,7 +31,6 @@ namespace mailio
 /**
 Base64 codec.
 
-@todo Add static method `string encode(string)` to be used by `smtp`?
 @todo Does it need the first line policy?
 **/
 class MAILIO_EXPORT base64 : public codec
@@ -76,6 +75,16 @@ public:
     **/
     std::vector<std::string> encode(const std::string& text) const;
 
+    /**
+    Encoding a string into a single Base64 line, without any line policy.
+
+    It is meant for the protocol commands such as authentication, where the encoded string must not be split.
+
+    @param text String to encode.
+    @return     Base64 encoded string.
+    **/
+    static std::string encode_line(const std::string& text);
+
     /**
     Decoding a vector of Base64 encoded strings to string by applying the line policy.
 
@@ -136,6 +136,11 @@ public:
     **/
     static const std::string SPACE_STR;
 
+    /**
+    Horizontal tab character.
+    **/
+    static const char TAB_CHAR = '\t';
+
     /**
     Exclamation mark character.
     **/
@@ -71,10 +71,18 @@ public:
     Sending a line to network synchronously or asynchronously, depending of the timeout value.
 
     @param line Line to send.
-    @throw *    `send_sync<Socket>(Socket&, const std::string&)`, `send_async<Socket>(Socket&, const std::string&)`.
+    @throw *    `send_raw(const std::string&)`.
     **/
     virtual void send(const std::string& line);
 
+    /**
+    Sending data to network as it is, without appending the end of line.
+
+    @param data Data to send.
+    @throw *    `send_sync<Socket>(Socket&, const std::string&)`, `send_async<Socket>(Socket&, const std::string&)`.
+    **/
+    virtual void send_raw(const std::string& data);
+
     /**
     Receiving a line from network.
 
@@ -84,17 +92,26 @@ public:
     **/
     virtual std::string receive(bool raw = false);
 
+    /**
+    Waiting for the incoming data at most the given time, without reading it.
+
+    @param wait         Time to wait for the data.
+    @return             True if the data is available for reading, false if the time expired.
+    @throw dialog_error Network waiting failed.
+    **/
+    virtual bool wait_read(std::chrono::milliseconds wait);
+
 protected:
 
     /**
-    Sending a line to network in synchronous manner.
+    Sending data to network in synchronous manner.
 
     @param socket       Socket to use for I/O.
-    @param line         Line to send.
+    @param data         Data to send.
     @throw dialog_error Network sending error.
     **/
     template<typename Socket>
-    void send_sync(Socket& socket, const std::string& line);
+    void send_sync(Socket& socket, const std::string& data);
 
     /**
     Receiving a line from network in synchronous manner.
@@ -116,15 +133,15 @@ protected:
     void connect_async();
 
     /**
-    Sending a line over network within the given timeout period.
+    Sending data over network within the given timeout period.
 
     @param socket       Socket to use for I/O.
-    @param line         Line to send.
+    @param data         Data to send.
     @throw dialog_error Network sending failed.
     @throw dialog_error Network sending timed out.
     **/
     template<typename Socket>
-    void send_async(Socket& socket, std::string line);
+    void send_async(Socket& socket, const std::string& data);
 
     /**
     Receiving a line over network within the given timeout period.
@@ -274,10 +291,19 @@ public:
     Sending an encrypted or unecrypted line, depending of SSL flag.
 
     @param line Line to send.
-    @throw *    `dialog::send(const std::string&)`, `send_sync<Socket>(Socket&, const std::string&)`, `send_async<Socket>(Socket&, const std::string&)`.
+    @throw *    `send_raw(const std::string&)`.
     **/
     void send(const std::string& line);
 
+    /**
+    Sending encrypted or unencrypted data as it is, depending of SSL flag.
+
+    @param data Data to send.
+    @throw *    `dialog::send_raw(const std::string&)`, `send_sync<Socket>(Socket&, const std::string&)`,
+                `send_async<Socket>(Socket&, const std::string&)`.
+    **/
+    void send_raw(const std::string& data);
+
     /**
     Receiving an encrypted or unecrypted line, depending of SSL state.
 
@@ -287,6 +313,15 @@ public:
     **/
     std::string receive(bool raw = false);
 
+    /**
+    Waiting for the incoming data at most the given time, taking into account the data already decrypted.
+
+    @param wait Time to wait for the data.
+    @return     True if the data is available for reading, false if the time expired.
+    @throw *    `dialog::wait_read(std::chrono::milliseconds)`.
+    **/
+    bool wait_read(std::chrono::milliseconds wait);
+
     /**
     Replacing a TCP socket with an SSL one.
 
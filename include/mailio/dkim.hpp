@@ -0,0 +1,197 @@
+/*
+
+dkim.hpp
+--------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#pragma once
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable:4251)
+#endif
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <openssl/evp.h>
+#include "message.hpp"
+#include "export.hpp"
+
+
+namespace mailio
+{
+
+
+/**
+DKIM signer of messages as described in the RFC 6376.
+
+Both the header and the body are canonicalized by the relaxed algorithm. The body is hashed while the message is being formatted, so the signature does
+not require another pass over the formatted message nor parsing it again.
+**/
+class MAILIO_EXPORT dkim_signer
+{
+public:
+
+    /**
+    Signing algorithms, RSA with SHA256 as of the RFC 6376, and Ed25519 with SHA256 as of the RFC 8463.
+    **/
+    enum class algorithm_t {RSA_SHA256, ED25519_SHA256};
+
+    /**
+    Headers signed by default, if present in the message.
+    **/
+    static const std::vector<std::string> DEFAULT_SIGNED_HEADERS;
+
+    /**
+    Setting the signing domain and the key.
+
+    @param domain         Signing domain, the `d=` tag.
+    @param selector       Selector of the public key in the domain, the `s=` tag.
+    @param private_key    Private key in the PEM format.
+    @param algorithm      Signing algorithm which has to match the key type.
+    @param signed_headers Names of the headers to sign.
+    @throw dkim_error     Empty domain or selector.
+    @throw dkim_error     Reading private key failure.
+    @throw dkim_error     Private key not matching the algorithm.
+    **/
+    dkim_signer(const std::string& domain, const std::string& selector, const std::string& private_key, algorithm_t algorithm = algorithm_t::RSA_SHA256,
+        const std::vector<std::string>& signed_headers = DEFAULT_SIGNED_HEADERS);
+
+    /**
+    Default copy constructor.
+    **/
+    dkim_signer(const dkim_signer&) = default;
+
+    /**
+    Default move constructor.
+    **/
+    dkim_signer(dkim_signer&&) = default;
+
+    /**
+    Default destructor.
+    **/
+    ~dkim_signer() = default;
+
+    dkim_signer& operator=(const dkim_signer&) = delete;
+
+    dkim_signer& operator=(dkim_signer&&) = delete;
+
+    /**
+    Formatting and signing the message.
+
+    @param msg        Message to sign.
+    @return           Formatted message with the `DKIM-Signature` header on top.
+    @throw dkim_error Signing failure.
+    @throw *          `message::format(const format_sink_t&, const message_format_options_t&)`.
+    **/
+    formatted_message sign(const message& msg) const;
+
+private:
+
+    /**
+    Relaxed canonicalization and hashing of the formatted message chunks.
+    **/
+    class canonicalizer;
+
+    /**
+    Canonicalizing a header field by the relaxed algorithm.
+
+    @param field Header name and value, possibly folded, without the trailing end of line.
+    @return      Canonicalized header without the trailing end of line.
+    **/
+    static std::string canonicalize_header(const std::string& field);
+
+    /**
+    Signing the data by the private key.
+
+    @param data       Data to sign.
+    @return           Signature encoded in Base64.
+    @throw dkim_error Signing failure.
+    **/
+    std::string sign_data(const std::string& data) const;
+
+    /**
+    Signing domain.
+    **/
+    const std::string domain_;
+
+    /**
+    Selector of the public key.
+    **/
+    const std::string selector_;
+
+    /**
+    Signing algorithm.
+    **/
+    const algorithm_t algorithm_;
+
+    /**
+    Names of the headers to sign.
+    **/
+    const std::vector<std::string> signed_headers_;
+
+    /**
+    Private key.
+    **/
+    std::shared_ptr<EVP_PKEY> private_key_;
+};
+
+
+/**
+Exception reported by the DKIM signer.
+**/
+class dkim_error : public std::runtime_error
+{
+public:
+
+    /**
+    Calling the parent constructor.
+
+    @param msg     Error message.
+    @param details Error message details.
+    **/
+    explicit dkim_error(const std::string& msg, const std::string& details) : std::runtime_error(msg), details_(details)
+    {
+    }
+
+    /**
+    Calling the parent constructor.
+
+    @param msg     Error message.
+    @param details Error message details.
+    **/
+    explicit dkim_error(const char* msg, const std::string& details) : std::runtime_error(msg), details_(details)
+    {
+    }
+
+    /**
+    Gets the error message details.
+
+    @return Detailed error message.
+    **/
+    std::string details() const;
+
+protected:
+
+    /**
+    Error message details which could provide more insights into a problem.
+    **/
+    std::string details_;
+};
+
+
+} // namespace mailio
+
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -18,19 +18,27 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 #pragma warning(disable:4251)
 #endif
 
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <variant>
-#include <optional>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/asio/streambuf.hpp>
 #include <boost/date_time/gregorian/gregorian.hpp>
+#include <cstddef>
 #include <cstdint>
 #include "dialog.hpp"
 #include "message.hpp"
@@ -64,7 +72,7 @@ public:
         /**
         Statistics information to be retrieved.
         **/
-        enum stat_info_t {DEFAULT = 0, UNSEEN = 1, UID_NEXT = 2, UID_VALIDITY = 4};
+        enum stat_info_t {DEFAULT = 0, UNSEEN = 1, UID_NEXT = 2, UID_VALIDITY = 4, HIGHEST_MODSEQ = 8};
 
 
         /**
@@ -111,10 +119,19 @@ public:
         unsigned long uid_validity;
 
 
+        /**
+        The non-zero highest modification sequence of the mailbox.
+
+        Zero indicates the server does not support the CONDSTORE extension or does not keep the modification sequences for the mailbox.
+        **/
+        unsigned long long highest_modseq;
+
+
         /**
         Setting the number of messages to zero.
         **/
-        mailbox_stat_t() : messages_no(0), messages_recent(0), messages_unseen(0), messages_first_unseen(0), uid_next(0), uid_validity(0)
+        mailbox_stat_t() : messages_no(0), messages_recent(0), messages_unseen(0), messages_first_unseen(0), uid_next(0), uid_validity(0),
+            highest_modseq(0)
         {
         }
     };
@@ -134,8 +151,13 @@ public:
 
     The following mechanisms are allowed:
     - LOGIN: The username and password are sent in plain format.
+    - PLAIN: The username and password are sent in Base64 format by the `AUTHENTICATE` command. If the server supports the initial response (SASL-IR),
+      then the credentials are sent within the command, so a single round trip is needed. If the server does not advertise the plain mechanism, then
+      the login command is used instead.
+    - XOAUTH2: The username and OAuth2 access token (given as the password) are sent by the `AUTHENTICATE` command, within it if the server supports the
+      initial response.
     **/
-    enum class auth_method_t {LOGIN};
+    enum class auth_method_t {LOGIN, PLAIN, XOAUTH2};
 
 
     /**
@@ -144,6 +166,291 @@ public:
     typedef std::pair<unsigned long, std::optional<unsigned long>> messages_range_t;
 
 
+    /**
+    Set of message IDs kept as the sorted intervals of consecutive IDs, so a large set takes as much memory as the number of its gaps.
+
+    The adjacent and overlapping intervals are merged when inserted, so the set is always formatted as the shortest sequence set. The largest ID stands
+    for the `*` character, which is the largest message number or UID in the mailbox. The iteration goes over the IDs in the ascending order. Since the
+    value of the `*` character is known only to the server, counting and iterating the IDs require a closed set, i.e. one without that character.
+    **/
+    class MAILIO_EXPORT messages_set_t
+    {
+    public:
+
+        /**
+        Last IDs of the intervals mapped by their first IDs.
+        **/
+        using intervals_t = std::map<unsigned long, unsigned long>;
+
+        /**
+        ID standing for the `*` character of the sequence set.
+        **/
+        static constexpr unsigned long LAST_ID = std::numeric_limits<unsigned long>::max();
+
+        /**
+        Iterator over the IDs of the set.
+        **/
+        class const_iterator
+        {
+        public:
+
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = unsigned long;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const unsigned long*;
+            using reference = const unsigned long&;
+
+            /**
+            Pointing to the first ID of the given interval.
+
+            @param interval Interval to point to.
+            @param end      End of the intervals.
+            **/
+            const_iterator(intervals_t::const_iterator interval, intervals_t::const_iterator end) :
+                interval_(interval), end_(end), id_(interval == end ? 0 : interval->first)
+            {
+            }
+
+            reference operator*() const
+            {
+                return id_;
+            }
+
+            pointer operator->() const
+            {
+                return &id_;
+            }
+
+            const_iterator& operator++()
+            {
+                if (id_ == interval_->second)
+                {
+                    ++interval_;
+                    id_ = interval_ == end_ ? 0 : interval_->first;
+                }
+                else
+                    ++id_;
+                return *this;
+            }
+
+            const_iterator operator++(int)
+            {
+                const_iterator it = *this;
+                ++*this;
+                return it;
+            }
+
+            bool operator==(const const_iterator& other) const
+            {
+                return interval_ == other.interval_ && id_ == other.id_;
+            }
+
+            bool operator!=(const const_iterator& other) const
+            {
+                return !(*this == other);
+            }
+
+        private:
+
+            /**
+            Current interval.
+            **/
+            intervals_t::const_iterator interval_;
+
+            /**
+            End of the intervals.
+            **/
+            intervals_t::const_iterator end_;
+
+            /**
+            Current ID.
+            **/
+            unsigned long id_;
+        };
+
+        /**
+        Making the empty set.
+        **/
+        messages_set_t() = default;
+
+        /**
+        Making the set of the given ranges, where the missing end of a range stands for the `*` character.
+
+        @param ranges Ranges of IDs.
+        **/
+        messages_set_t(std::initializer_list<messages_range_t> ranges);
+
+        /**
+        Making the set of the given ranges, where the missing end of a range stands for the `*` character.
+
+        @param ranges Ranges of IDs.
+        **/
+        messages_set_t(const std::list<messages_range_t>& ranges);
+
+        /**
+        Adding an ID to the set.
+
+        @param id ID to add.
+        **/
+        void insert(unsigned long id);
+
+        /**
+        Adding an interval of IDs to the set.
+
+        @param first First ID of the interval.
+        @param last  Last ID of the interval.
+        **/
+        void insert(unsigned long first, unsigned long last);
+
+        /**
+        Checking if the set contains an ID.
+
+        @param id ID to check.
+        @return   True if the ID is in the set, false if not.
+        **/
+        bool contains(unsigned long id) const;
+
+        /**
+        Checking if the set is empty.
+
+        @return True if there are no IDs, false if there are.
+        **/
+        bool empty() const;
+
+        /**
+        Checking if the set is closed, so it does not contain the `*` character.
+
+        @return True if no interval ends by `LAST_ID`, false if the last one does.
+        **/
+        bool closed() const;
+
+        /**
+        Counting the IDs of the set.
+
+        @return           Number of the IDs.
+        @throw imap_error Open messages set.
+        **/
+        unsigned long size() const;
+
+        /**
+        Getting the intervals of the set.
+
+        @return Intervals of the IDs.
+        **/
+        const intervals_t& intervals() const;
+
+        /**
+        Getting the iterator to the first ID.
+
+        @return           Iterator to the smallest ID.
+        @throw imap_error Open messages set.
+        **/
+        const_iterator begin() const;
+
+        /**
+        Getting the iterator past the last ID.
+
+        @return Iterator past the largest ID.
+        **/
+        const_iterator end() const;
+
+        /**
+        Formatting the set as the IMAP sequence set.
+
+        @return Sequence set like `1:4,7`.
+        **/
+        std::string to_string() const;
+
+        /**
+        Formatting the set as the IMAP sequence sets, each not longer than the given length unless a single interval is longer.
+
+        @param max_length Maximal length of a sequence set.
+        @return           Sequence sets which together contain the IDs of the set.
+        **/
+        std::vector<std::string> to_strings(std::string::size_type max_length) const;
+
+        /**
+        Adding the IDs of another set.
+
+        @param other Set to unite with.
+        @return      This set.
+        **/
+        messages_set_t& operator|=(const messages_set_t& other);
+
+        /**
+        Keeping only the IDs which are in another set as well.
+
+        @param other Set to intersect with.
+        @return      This set.
+        **/
+        messages_set_t& operator&=(const messages_set_t& other);
+
+        /**
+        Removing the IDs of another set.
+
+        @param other Set to subtract.
+        @return      This set.
+        **/
+        messages_set_t& operator-=(const messages_set_t& other);
+
+        /**
+        Uniting with another set.
+
+        @param other Set to unite with.
+        @return      Union of the sets.
+        **/
+        messages_set_t operator|(const messages_set_t& other) const;
+
+        /**
+        Intersecting with another set.
+
+        @param other Set to intersect with.
+        @return      Intersection of the sets.
+        **/
+        messages_set_t operator&(const messages_set_t& other) const;
+
+        /**
+        Subtracting another set.
+
+        @param other Set to subtract.
+        @return      Difference of the sets.
+        **/
+        messages_set_t operator-(const messages_set_t& other) const;
+
+        /**
+        Comparing the IDs of the sets.
+
+        @param other Set to compare with.
+        @return      True if the sets have the same IDs, false if not.
+        **/
+        bool operator==(const messages_set_t& other) const;
+
+        /**
+        Comparing the IDs of the sets.
+
+        @param other Set to compare with.
+        @return      True if the sets differ, false if not.
+        **/
+        bool operator!=(const messages_set_t& other) const;
+
+        /**
+        Parsing the IMAP sequence set.
+
+        @param sequence_set Sequence set to parse.
+        @return             Set of the IDs.
+        @throw imap_error   Parsing failure.
+        **/
+        static messages_set_t from_string(std::string_view sequence_set);
+
+    private:
+
+        /**
+        Intervals of the IDs.
+        **/
+        intervals_t intervals_;
+    };
+
+
     /**
     Condition used by IMAP searching.
 
@@ -187,7 +494,7 @@ public:
         <
             std::monostate,
             std::string,
-            std::list<messages_range_t>,
+            messages_set_t,
             boost::gregorian::date
         >
         value_type;
@@ -216,6 +523,43 @@ public:
     };
 
 
+    /**
+    Result of the search, as returned by the ESEARCH extension.
+    **/
+    struct search_result_t
+    {
+        /**
+        Result items to be returned.
+        **/
+        enum return_t {MIN = 1, MAX = 2, COUNT = 4, ALL = 8};
+
+        /**
+        Smallest found message number or UID, if asked and found.
+        **/
+        std::optional<unsigned long> min;
+
+        /**
+        Largest found message number or UID, if asked and found.
+        **/
+        std::optional<unsigned long> max;
+
+        /**
+        Number of the found messages, if asked.
+        **/
+        std::optional<unsigned long> count;
+
+        /**
+        Found message numbers or UIDs, if asked.
+        **/
+        messages_set_t all;
+    };
+
+
+    /**
+    Operation of storing the message flags: replacing the flags, adding them or removing them.
+    **/
+    enum class store_op_t {SET, ADD, REMOVE};
+
     /**
     Options available when fetching a message.
 
@@ -225,6 +569,232 @@ public:
     **/
     enum class fetch_options_t : uint8_t { DEFAULT = 0, HEADER_ONLY = 1, IS_UID = 2, FLAGS = 4 };
 
+    /**
+    Message attributes of a fetch response, other than the message literal.
+    **/
+    struct fetch_response_t
+    {
+        /**
+        Message sequence number.
+        **/
+        unsigned long sequence_no = 0;
+
+        /**
+        Message UID, zero if not given by the server.
+        **/
+        unsigned long uid = 0;
+
+        /**
+        Message flags, if asked for.
+        **/
+        std::vector<std::string> flags;
+
+        /**
+        Modification sequence of the message, zero if not given by the server.
+        **/
+        unsigned long long modseq = 0;
+    };
+
+    /**
+    Changes of the mailbox since a known modification sequence.
+    **/
+    struct mailbox_changes_t
+    {
+        /**
+        Fetch responses of the changed messages, with the UIDs, flags and modification sequences.
+        **/
+        std::vector<fetch_response_t> changed;
+
+        /**
+        UIDs of the removed messages.
+        **/
+        messages_set_t vanished;
+    };
+
+    /**
+    Statistics of several mailboxes, with the mailboxes whose statistics are refused by the server.
+    **/
+    struct mailboxes_statistics_t
+    {
+        /**
+        Statistics mapped by the mailbox names as requested.
+        **/
+        std::map<std::string, mailbox_stat_t> statistics;
+
+        /**
+        Server responses of the failed status commands, mapped by the mailbox names as requested.
+        **/
+        std::map<std::string, std::string> failures;
+    };
+
+    /**
+    Consumer of a fetched message literal, receiving the message sequence number and the literal chunk by chunk.
+    **/
+    using literal_sink_t = std::function<void(unsigned long, const std::string&)>;
+
+    /**
+    Consumer of the fetch response attributes, called once the response of a message is complete.
+    **/
+    using fetch_response_callback_t = std::function<void(const fetch_response_t&)>;
+
+    /**
+    Consumer of a fetched message, receiving the message number or UID and the parsed message.
+    **/
+    using message_callback_t = std::function<void(unsigned long, message&&)>;
+
+    /**
+    Message attributes needed to list a mailbox, fetched without the message itself.
+
+    The subject and the names of the addresses are as given by the server, so they may be encoded.
+    **/
+    struct message_summary_t
+    {
+        /**
+        Message sequence number.
+        **/
+        unsigned long sequence_no = 0;
+
+        /**
+        Message UID.
+        **/
+        unsigned long uid = 0;
+
+        /**
+        Message flags.
+        **/
+        std::vector<std::string> flags;
+
+        /**
+        Size of the message in octets.
+        **/
+        unsigned long size = 0;
+
+        /**
+        Date header as given by the server.
+        **/
+        std::string date;
+
+        /**
+        Subject header as given by the server.
+        **/
+        std::string subject;
+
+        /**
+        Authors of the message.
+        **/
+        std::vector<mail_address> from;
+
+        /**
+        Message ID header as given by the server.
+        **/
+        std::string message_id;
+
+        /**
+        Additionally asked header fields mapped by their names in lower case.
+        **/
+        std::map<std::string, std::string> header_fields;
+    };
+
+    /**
+    Change of the selected mailbox announced by the server while idling.
+    **/
+    struct idle_event_t
+    {
+        /**
+        Kind of the change: new number of messages, new number of recent messages, removed message, changed flags of a message or removed UIDs
+        once the QRESYNC extension is enabled.
+        **/
+        enum class event_type_t {EXISTS, RECENT, EXPUNGE, FETCH, VANISHED} event_type = event_type_t::EXISTS;
+
+        /**
+        Number of messages for the exists and recent changes, message sequence number for the expunge and fetch changes.
+        **/
+        unsigned long number = 0;
+
+        /**
+        Message attributes of the fetch change.
+        **/
+        fetch_response_t response;
+
+        /**
+        UIDs of the vanished change.
+        **/
+        messages_set_t vanished;
+    };
+
+    /**
+    Consumer of the idle changes, returning whether to keep idling.
+    **/
+    using idle_callback_t = std::function<bool(const idle_event_t&)>;
+
+    /**
+    Consumer of a downloaded message, receiving the offset of each chunk and the chunk itself.
+    **/
+    using range_sink_t = std::function<void(unsigned long, const std::string&)>;
+
+    /**
+    Default number of octets fetched at once by the downloader.
+    **/
+    static const unsigned long DOWNLOAD_CHUNK_SIZE = 1048576;
+
+    /**
+    Part of the message body structure, as announced by the server without downloading the message.
+
+    The media types, the transfer encoding, the disposition and the parameter names are in lower case.
+    **/
+    struct body_part_t
+    {
+        /**
+        Section of the part to be given when fetching the part, empty for the multipart message itself.
+        **/
+        std::string section;
+
+        /**
+        Media type.
+        **/
+        std::string type;
+
+        /**
+        Media subtype.
+        **/
+        std::string subtype;
+
+        /**
+        Content type parameters, like the charset or the boundary.
+        **/
+        std::map<std::string, std::string> parameters;
+
+        /**
+        Content transfer encoding, empty for a multipart.
+        **/
+        std::string encoding;
+
+        /**
+        Size of the encoded part in octets, zero for a multipart.
+        **/
+        unsigned long size = 0;
+
+        /**
+        Number of lines of a text or message part.
+        **/
+        unsigned long lines = 0;
+
+        /**
+        Content disposition, empty if not given.
+        **/
+        std::string disposition;
+
+        /**
+        Attachment name taken from the disposition, or from the content type if not in the disposition.
+        **/
+        std::string filename;
+
+        /**
+        Parts of a multipart, or the body of an attached message.
+        **/
+        std::vector<body_part_t> parts;
+    };
+
 
     /**
     Creating a connection to a server.
@@ -259,7 +829,7 @@ public:
     @param method   Authentication method to use.
     @return         The server greeting message.
 
-    @throw *        `connect()`, `auth_login(const string&, const string&)`.
+    @throw *        `connect()`, `auth_login(const string&, const string&)`, `auth_sasl(const string&, const string&)`.
     **/
     std::string authenticate(const std::string& username, const std::string& password, auth_method_t method);
 
@@ -289,6 +859,35 @@ public:
     **/
     mailbox_stat_t select(const std::string& mailbox, bool read_only = false);
 
+    /**
+    Selecting a mailbox and getting its changes since the last synchronization, by the QRESYNC extension.
+
+    The extension must be enabled before. If the UID validity has changed meanwhile, the server reports no changes and the mailbox has to be fully
+    synchronized.
+
+    @param mailbox      Mailbox to select.
+    @param uid_validity UID validity of the mailbox known from the last synchronization.
+    @param modseq       Highest modification sequence known from the last synchronization.
+    @param known_uids   UIDs known by the client, empty if all of them.
+    @param changes      Changed messages and removed UIDs since the given modification sequence.
+    @param read_only    Flag if the selected mailbox is only readable or also writable.
+    @return             Mailbox statistics.
+    @throw *            `select_responses(const string&, mailbox_changes_t&)`.
+    **/
+    mailbox_stat_t select(const std::string& mailbox, unsigned long uid_validity, unsigned long long modseq, const messages_set_t& known_uids,
+        mailbox_changes_t& changes, bool read_only = false);
+
+    /**
+    Enabling the server extensions, like CONDSTORE and QRESYNC.
+
+    @param extensions Extension names to enable.
+    @return           Extensions enabled by the server.
+    @throw imap_error Enabling extensions failure.
+    @throw imap_error Parsing failure.
+    @throw *          `parse_tag_result(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    std::vector<std::string> enable(const std::vector<std::string>& extensions);
+
 
     /**
     Fetching a message from the mailbox.
@@ -303,7 +902,7 @@ public:
     @param header_only Flag if only the message header should be fetched.
     @throw imap_error  Fetching message failure.
     @throw imap_error  Parsing failure.
-    @throw *           `fetch(const list<messages_range_t>&, map<unsigned long, message>&, bool, bool, codec::line_len_policy_t)`.
+    @throw *           `fetch(const messages_set_t&, map<unsigned long, message>&, bool, bool, codec::line_len_policy_t)`.
     @todo              Add server error messages to exceptions.
     **/
     void fetch(const std::string& mailbox, unsigned long message_no, bool is_uid, message& msg, bool header_only = false);
@@ -321,7 +920,7 @@ public:
     @param msg         Message to store the result.
     @param is_uid      Using a message uid number instead of a message sequence number.
     @param header_only Flag if only the message header should be fetched.
-    @throw *           `fetch(const list<messages_range_t>&, map<unsigned long, message>&, bool, bool, codec::line_len_policy_t)`.
+    @throw *           `fetch(const messages_set_t&, map<unsigned long, message>&, bool, bool, codec::line_len_policy_t)`.
     @todo              Add server error messages to exceptions.
     **/
     void fetch(unsigned long message_no, message& msg, bool is_uid = false, bool header_only = false);
@@ -341,9 +940,9 @@ public:
     @param is_uids        Using message UID numbers instead of a message sequence numbers.
     @param header_only    Flag if only the message headers should be fetched.
     @param line_policy    Decoder line policy to use while parsing each message.
-    @throw *              `fetch(const std::list<messages_range_t>&, fetch_options_t, codec::line_len_policy_t)`.
+    @throw *              `fetch(const messages_set_t&, fetch_options_t, codec::line_len_policy_t)`.
     **/
-    void fetch(const std::list<messages_range_t>& messages_range, std::map<unsigned long, message>& found_messages, bool is_uids = false,
+    void fetch(const messages_set_t& messages_range, std::map<unsigned long, message>& found_messages, bool is_uids = false,
         bool header_only = false, codec::line_len_policy_t line_policy = codec::line_len_policy_t::RECOMMENDED);
 
 
@@ -359,20 +958,153 @@ public:
     @param options        Selected options when fetching a message.
     @param line_policy    Decoder line policy to use while parsing each message.
     @return               Map of messages to store the results, indexed by message number or uid.
-    @throw imap_error     Empty messages range.
-    @throw imap_error     Fetching message failure.
-    @throw imap_error     Expecting the fetch atom.
-    @throw imap_error     No uid number when fetching a message.
-    @throw imap_error     Parsing failure.
-    @throw imap_error     No literal when fetching a message.
-    @throw *              `parse_tag_result(const string&)`, `parse_grammar(const string&)`,
-                          `dialog::send(const string&)`, `dialog::receive()`, `message::parse(const string&, bool)`.
+    @throw *              `fetch(const messages_set_t&, fetch_options_t, const message_callback_t&, codec::line_len_policy_t)`.
     @todo                 Add server error messages to exceptions.
     **/
     std::map<unsigned long, message>
-    fetch(const std::list<messages_range_t>& messages_range, fetch_options_t options, codec::line_len_policy_t line_policy =
+    fetch(const messages_set_t& messages_range, fetch_options_t options, codec::line_len_policy_t line_policy =
         codec::line_len_policy_t::RECOMMENDED);
 
+    /**
+    Fetching messages from an already selected mailbox, passing each message to the callback as soon as its response is complete.
+
+    The messages are not collected, so processing them overlaps with receiving the next ones, and only a single message is held in memory at once. If the
+    parsing or the callback fails, the rest of the responses is still read, and the exception is thrown afterwards.
+
+    If parser threads are set, then the messages are parsed concurrently while the next responses are received. The callback is still called on the
+    calling thread, in the order of the responses, and the number of messages waiting to be parsed is limited to twice the number of threads.
+
+    @param messages_range Range of message SIDs or UIDs to fetch.
+    @param options        Selected options when fetching a message.
+    @param callback       Consumer of the fetched messages, given the message number or uid.
+    @param line_policy    Decoder line policy to use while parsing each message.
+    @throw *              `fetch_command(const messages_set_t&, fetch_options_t)`, `fetch_responses(const string&, const fetch_literal_callback_t&)`,
+                          `message::parse(const string&, bool)`.
+    **/
+    void fetch(const messages_set_t& messages_range, fetch_options_t options, const message_callback_t& callback,
+        codec::line_len_policy_t line_policy = codec::line_len_policy_t::RECOMMENDED);
+
+    /**
+    Fetching messages from an already selected mailbox, streaming their literals to the sink.
+
+    The literals are not stored, each chunk is passed to the sink as soon as it is read from the connection. The chunk is a literal line including its
+    end of line, except the last one which may not end with it. The parsed tokens of a response are dropped once the response is complete, so the memory
+    does not grow with the number of fetched messages.
+
+    The UID of a message may come after its literal, so the sink is given the sequence number, and the callback maps it to the UID once the response
+    is complete.
+
+    @param messages_range Range of message SIDs or UIDs to fetch.
+    @param sink           Consumer of the message literals.
+    @param options        Selected options when fetching a message.
+    @param callback       Consumer of the message UID and flags, called after the message literal is passed to the sink.
+    @throw *              `fetch_command(const messages_set_t&, fetch_options_t)`, `fetch_responses(const string&, const fetch_literal_callback_t&)`,
+                          exception of the sink or of the callback once the tagged response is read.
+    **/
+    void fetch_literals(const messages_set_t& messages_range, const literal_sink_t& sink, fetch_options_t options = fetch_options_t::DEFAULT,
+        const fetch_response_callback_t& callback = nullptr);
+
+
+    /**
+    Fetching the body structures of messages from an already selected mailbox.
+
+    @param messages_range Range of message SIDs or UIDs to fetch.
+    @param is_uid         Using a message UID number instead of a message sequence number.
+    @return               Body structures mapped by the message number or UID.
+    @throw imap_error     Empty messages range.
+    @throw *              `fetch_responses(const string&, const fetch_literal_callback_t&)`, `parse_body_structure(const grammar_token_t&, const string&,
+                          body_part_t&)`.
+    **/
+    std::map<unsigned long, body_part_t> fetch_structure(const messages_set_t& messages_range, bool is_uid = false);
+
+    /**
+    Fetching the summaries of messages from an already selected mailbox, without marking the messages as seen.
+
+    The summary is taken from the envelope, and the given header fields are fetched in addition.
+
+    @param messages_range Range of message SIDs or UIDs to fetch.
+    @param is_uid         Using a message UID number instead of a message sequence number.
+    @param header_fields  Names of the header fields to fetch in addition to the envelope.
+    @return               Message summaries mapped by the message number or UID.
+    @throw imap_error     Empty messages range.
+    @throw *              `fetch_responses(const string&, const fetch_literal_callback_t&)`, `parse_envelope(const grammar_token_t&,
+                          message_summary_t&)`, `parse_header_fields(const string&, map<string, string>&)`.
+    **/
+    std::map<unsigned long, message_summary_t> fetch_summaries(const messages_set_t& messages_range, bool is_uid = false,
+        const std::vector<std::string>& header_fields = {});
+
+    /**
+    Fetching the flags of messages from an already selected mailbox.
+
+    @param messages_range Range of message SIDs or UIDs to fetch.
+    @param is_uid         Using a message UID number instead of a message sequence number.
+    @return               Fetch responses with the UIDs and flags, mapped by the message number or UID.
+    @throw imap_error     Empty messages range.
+    @throw *              `fetch_responses(const string&, const fetch_literal_callback_t&)`.
+    **/
+    std::map<unsigned long, fetch_response_t> fetch_flags(const messages_set_t& messages_range, bool is_uid = false);
+
+    /**
+    Fetching the flags of messages changed since the given modification sequence, by the CONDSTORE extension.
+
+    The removed messages are reported only with the QRESYNC extension enabled.
+
+    @param uids           Range of message UIDs to check.
+    @param modseq         Highest modification sequence known from the last synchronization.
+    @param vanished       Flag if the UIDs of the removed messages are asked as well.
+    @return               Changed messages and removed UIDs.
+    @throw imap_error     Empty messages range.
+    @throw imap_error     Fetching message failure.
+    @throw *              `pipeline(const vector<string>&, const function<void()>&)`, `parse_fetch_response()`, `parse_vanished()`.
+    **/
+    mailbox_changes_t fetch_changes(const messages_set_t& uids, unsigned long long modseq, bool vanished = false);
+
+    /**
+    Fetching a single part of a message from an already selected mailbox, without marking the message as seen.
+
+    The part content is returned as it is, so it has to be decoded by the transfer encoding of the part.
+
+    @param uid        UID of the message.
+    @param section    Section of the part, as given by the body structure.
+    @return           Encoded content of the part.
+    @throw *          `fetch_body_item(unsigned long, const string&)`.
+    **/
+    std::string fetch_part(unsigned long uid, const std::string& section);
+
+    /**
+    Fetching a range of octets of a message part from an already selected mailbox, without marking the message as seen.
+
+    @param uid     UID of the message.
+    @param section Section of the part, empty for the whole message.
+    @param start   Offset of the first octet to fetch.
+    @param count   Number of octets to fetch.
+    @return        Fetched octets, less than the given count if the end of the part is reached.
+    @throw *       `fetch_body_item(unsigned long, const string&)`.
+    **/
+    std::string fetch_part(unsigned long uid, const std::string& section, unsigned long start, unsigned long count);
+
+    /**
+    Downloading a message or its part chunk by chunk, passing the chunks to the sink.
+
+    At most one chunk is kept in memory. If the download fails, it can be resumed on a new connection from the offset following the last chunk given to
+    the sink.
+
+    The download ends with the first chunk shorter than the chunk size. Its end is then checked against the size announced by the server, which is the
+    `RFC822.SIZE` for the whole message and the body structure size for a numbered part, so a truncated reply is not taken as the end of the part.
+
+    @param uid        UID of the message.
+    @param sink       Consumer of the chunks.
+    @param offset     Offset to start the download from.
+    @param chunk_size Number of octets fetched at once.
+    @param section    Section of the part, empty for the whole message.
+    @return           Offset after the last downloaded octet, thus the size if the download starts from zero.
+    @throw imap_error Zero chunk size.
+    @throw imap_error Download truncation.
+    @throw *          `fetch_part(unsigned long, const string&, unsigned long, unsigned long)`, `announced_size(unsigned long, const string&)`, exception
+                      of the sink.
+    **/
+    unsigned long download(unsigned long uid, const range_sink_t& sink, unsigned long offset = 0, unsigned long chunk_size = DOWNLOAD_CHUNK_SIZE,
+        const std::string& section = "");
 
     /**
     Appending a message to the given folder.
@@ -388,11 +1120,19 @@ public:
 
     @param folder_name Folder to append the message.
     @param msg         Message to append.
-    @throw imap_error  `Message appending failure.`, `parse_tag_result(const string&)`, `dialog::send(const string&)`, `dialog::receive()`,
-                       `message::format(std::string&, bool)`.
+    @throw *           `append(const string&, const formatted_message&)`, `formatted_message::formatted_message(const message&, bool)`.
     **/
     void append(const std::string& folder_name, const message& msg);
 
+    /**
+    Appending an already formatted message to the given folder.
+
+    @param folder_name Folder to append the message.
+    @param msg         Formatted message to append.
+    @throw imap_error  `Message appending failure.`, `parse_tag_result(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    void append(const std::string& folder_name, const formatted_message& msg);
+
     /**
     Getting the mailbox statistics.
 
@@ -401,14 +1141,26 @@ public:
     @param mailbox    Mailbox name.
     @param info       Statistics information to be retrieved.
     @return           Mailbox statistics.
-    @throw imap_error Parsing failure.
+    @throw imap_error No messages or recent messages found.
     @throw imap_error Getting statistics failure.
-    @throw *          `parse_tag_result(const string&)`, `parse_grammar(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    @throw *          `pipeline(const vector<string>&, const function<void()>&)`, `parse_status(mailbox_stat_t&)`.
     @todo             Add server error messages to exceptions.
-    @todo             Exceptions by `stoul()` should be rethrown as parsing failure.
     **/
     mailbox_stat_t statistics(const std::string& mailbox, unsigned int info = mailbox_stat_t::DEFAULT);
 
+    /**
+    Getting the statistics of several mailboxes at once.
+
+    The status commands are pipelined, so all of them cost a single round trip. A mailbox whose status is refused, for instance since it does not exist,
+    is reported as failed without affecting the others.
+
+    @param mailboxes  Mailbox names.
+    @param info       Statistics information to be retrieved.
+    @return           Mailbox statistics and failures mapped by the mailbox names.
+    @throw *          `pipeline(const vector<string>&, const function<void()>&)`, `parse_status(mailbox_stat_t&)`.
+    **/
+    mailboxes_statistics_t mailboxes_statistics(const std::list<std::string>& mailboxes, unsigned int info = mailbox_stat_t::DEFAULT);
+
 
     /**
     Overload of the `statistics(const std::string&, unsigned int)`.
@@ -457,6 +1209,39 @@ public:
     **/
     void remove(unsigned long message_no, bool is_uid = false);
 
+    /**
+    Removing messages from an already selected mailbox.
+
+    The messages are marked as deleted and expunged by a single batch of commands. The UIDPLUS extension is required, since it expunges only the given
+    messages, while the plain expunge would remove all messages marked as deleted in the mailbox.
+
+    @param uids       UIDs of the messages to remove.
+    @throw imap_error No UIDPLUS extension.
+    @throw imap_error Empty messages range.
+    @throw imap_error Deleting message failure.
+    @throw *          `pipeline(const vector<string>&, const function<void()>&)`.
+    **/
+    void remove(const messages_set_t& uids);
+
+    /**
+    Storing the flags of messages in an already selected mailbox.
+
+    Long sets of messages are split into several store commands, which are pipelined. The commands are written in windows, each once the responses of
+    the previous one are read, so the resulting flags sent for many messages cannot stall the connection.
+
+    @param messages_range Range of message SIDs or UIDs to store the flags of.
+    @param op             Operation on the flags.
+    @param flags          Flags to store.
+    @param silent         Flag if the server should not send the resulting flags.
+    @param is_uid         Using a message UID number instead of a message sequence number.
+    @return               Resulting flags mapped by the message number or UID, empty if silent unless the server sends them anyway.
+    @throw imap_error     Empty messages range.
+    @throw imap_error     Storing flags failure.
+    @throw *              `pipeline(const vector<string>&, const function<void()>&)`, `parse_fetch_response()`.
+    **/
+    std::map<unsigned long, fetch_response_t> store_flags(const messages_set_t& messages_range, store_op_t op, const std::vector<std::string>& flags,
+        bool silent = true, bool is_uid = false);
+
     /**
     Searching a mailbox.
 
@@ -472,7 +1257,45 @@ public:
     @throw *           `parse_tag_result(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
     @todo              Add server error messages to exceptions.
     **/
-    void search(const std::list<search_condition_t>& conditions, std::list<unsigned long>& results, bool want_uids = false);
+    void search(const std::list<search_condition_t>& conditions, std::list<unsigned long>& results, bool want_uids = false);
+
+    /**
+    Searching a mailbox, returning only the asked result items.
+
+    By the ESEARCH extension, the found messages are given as the sequence set, so a large result is sent and kept compactly. If the server does not
+    support the extension, the result items are made from the plain search.
+
+    @param conditions List of conditions taken in conjuction way.
+    @param returned   Result items to be returned, as the flags of `search_result_t::return_t`.
+    @param want_uids  Return message UIDs instead of message sequence numbers.
+    @return           Asked result items.
+    @throw imap_error Search mailbox failure.
+    @throw imap_error Parsing failure.
+    @throw *          `search(const string&, list<unsigned long>&, bool)`, `messages_set_t::from_string(string_view)`,
+                      `parse_tag_result(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    search_result_t search(const std::list<search_condition_t>& conditions, unsigned int returned, bool want_uids = false);
+
+    /**
+    Idling on the selected mailbox, passing the changes announced by the server to the callback.
+
+    The idling lasts until the callback returns false or `idle_stop()` is called. Since the server may drop the connection idling for thirty minutes, the
+    idle command is renewed after the given period.
+
+    @param callback   Consumer of the mailbox changes.
+    @param renewal    Period after which the idle command is renewed.
+    @throw imap_error Idle failure.
+    @throw *          `parse_tag_result(const string&)`, `idle_response(const string&, const idle_callback_t&)`, `dialog::send(const string&)`,
+                      `dialog::receive()`, `dialog::wait_read(milliseconds)`, exception of the callback once the idling is finished.
+    **/
+    void idle(const idle_callback_t& callback, std::chrono::milliseconds renewal = std::chrono::minutes(28));
+
+    /**
+    Stopping the idling, to be called from another thread.
+
+    The idling is finished within a second, as the stop is checked while waiting for the server.
+    **/
+    void idle_stop();
 
     /**
     Creating folder.
@@ -576,6 +1399,13 @@ public:
     **/
     void ssl_options(const std::optional<dialog_ssl::ssl_options_t> options);
 
+    /**
+    Setting the number of threads parsing the fetched messages.
+
+    @param threads Number of parsing threads. If zero, then the messages are parsed on the calling thread.
+    **/
+    void parser_threads(unsigned threads);
+
     /**
     Determining folder delimiter of a mailbox.
 
@@ -605,6 +1435,40 @@ protected:
     **/
     static std::string messages_range_list_to_string(std::list<messages_range_t> ranges);
 
+    /**
+    Maximal length of the sequence set in a single command, as the servers may limit the length of the command line.
+    **/
+    static const std::string::size_type SEQUENCE_SET_MAX_LENGTH = 8000;
+
+    /**
+    Maximal length of the commands written at once by the pipeline, small enough to fit into the socket buffers.
+    **/
+    static const std::string::size_type PIPELINE_WINDOW_LENGTH = 16384;
+
+    /**
+    Maximal capacity of the literal kept by a reused token, so a large literal does not stay allocated for the rest of the connection.
+    **/
+    static const std::string::size_type TOKEN_LITERAL_MAX_CAPACITY = 4096;
+
+    /**
+    Maximal length reserved for a literal before it is read, so a literal size announced by the server does not allocate more than it sends.
+    **/
+    static const std::string::size_type LITERAL_MAX_RESERVE = 1024 * 1024;
+
+    /**
+    Making the store commands of the message flags.
+
+    @param messages_range Range of message SIDs or UIDs to store the flags of.
+    @param op             Operation on the flags.
+    @param flags          Flags to store.
+    @param silent         Flag if the server should not send the resulting flags.
+    @param is_uid         Using a message UID number instead of a message sequence number.
+    @return               Store commands without the tags.
+    @throw imap_error     Empty messages range.
+    **/
+    static std::vector<std::string> store_commands(const messages_set_t& messages_range, store_op_t op, const std::vector<std::string>& flags,
+        bool silent, bool is_uid);
+
     /**
     Escaping the double quote and backslashes.
 
@@ -623,6 +1487,11 @@ protected:
     **/
     static const std::string CONTINUE_RESPONSE;
 
+    /**
+    Name of the primary mailbox, case insensitive as defined by the protocol.
+    **/
+    static const std::string INBOX_MAILBOX;
+
     /**
     Colon as a separator in the message list range.
     **/
@@ -725,6 +1594,40 @@ protected:
     **/
     void auth_login(const std::string& username, const std::string& password);
 
+    /**
+    Performing an authentication by using the `AUTHENTICATE` command.
+
+    If the server supports the SASL initial response as defined by RFC 4959, the response is sent within the command. Otherwise, it is sent once the
+    server continuation is received. Any further continuation is a failure report, so it is answered with the empty line.
+
+    @param mechanism        SASL mechanism name.
+    @param initial_response Initial response not encoded yet.
+    @throw imap_error       Incorrect tag.
+    @throw imap_error       Authentication failure.
+    @throw *                `has_capability(const string&)`, `parse_tag_result(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    void auth_sasl(const std::string& mechanism, const std::string& initial_response);
+
+    /**
+    Checking if the server announces the given capability.
+
+    If the capabilities are not known yet, they are requested by the `CAPABILITY` command.
+
+    @param capability Capability name to check.
+    @return           True if the capability is announced, false if not.
+    @throw *          `read_capabilities()`.
+    **/
+    bool has_capability(const std::string& capability);
+
+    /**
+    Requesting the server capabilities by the `CAPABILITY` command.
+
+    @throw imap_error Incorrect tag.
+    @throw imap_error Reading capabilities failure.
+    @throw *          `parse_tag_result(const string&)`, `parse_grammar(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    void read_capabilities();
+
     /**
     Searching a mailbox.
 
@@ -796,6 +1699,75 @@ protected:
         std::string to_string() const;
     };
 
+    /**
+    Sending several commands at once, and then reading the responses of all of them.
+
+    The commands are written in windows of about `PIPELINE_WINDOW_LENGTH` characters, each window once the responses of the previous one are read.
+    The untagged responses cannot be matched with the commands, so they are passed to the handler, which finds them parsed in the mandatory and optional
+    parts. The tagged responses are matched with the commands by the tags. The commands must not expect a continuation.
+
+    @param commands   Commands without the tags.
+    @param handler    Consumer of the untagged responses.
+    @return           Tagged responses in the order of the commands.
+    @throw imap_error Parsing failure.
+    @throw *          `parse_tag_result(const string&)`, `parse_grammar(const string&)`, `dialog::send_raw(const string&)`, `dialog::receive()`,
+                      exception of the handler once all the tagged responses are read.
+    **/
+    std::vector<tag_result_response_t> pipeline(const std::vector<std::string>& commands, const std::function<void()>& handler);
+
+    /**
+    Parsing an untagged response received while idling and passing the change to the callback.
+
+    @param response   Untagged response without the asterisk.
+    @param callback   Consumer of the mailbox changes.
+    @return           Result of the callback, or true if the response is not a change.
+    @throw imap_error Idle failure.
+    @throw *          `parse_grammar(const string&)`, `parse_fetch_response()`, `dialog::receive()`.
+    **/
+    bool idle_response(const std::string& response, const idle_callback_t& callback);
+
+    /**
+    Making the status command for the given mailbox.
+
+    @param mailbox Mailbox name.
+    @param info    Statistics information to be retrieved.
+    @return        Status command without the tag.
+    **/
+    static std::string status_command(const std::string& mailbox, unsigned int info);
+
+    /**
+    Parsing the status response held by the mandatory part.
+
+    @param stat       Statistics to store the parsed values.
+    @return           Mailbox name of the response, none if the response is not a status one.
+    @throw imap_error No messages or recent messages found.
+    @throw imap_error Parsing failure.
+    **/
+    std::optional<std::string> parse_status(mailbox_stat_t& stat) const;
+
+    /**
+    Reading the responses of the select or examine command.
+
+    @param command    Select or examine command without the tag.
+    @param changes    Changed messages and removed UIDs reported by the QRESYNC extension.
+    @return           Mailbox statistics.
+    @throw imap_error Select or examine mailbox failure.
+    @throw imap_error Number expected for unseen, uidnext, uidvalidity or highestmodseq.
+    @throw imap_error No number of existing or recent messages.
+    @throw imap_error Parsing failure.
+    @throw *          `parse_tag_result(const string&)`, `parse_fetch_response()`, `parse_vanished()`, `dialog::send(const string&)`,
+                      `dialog::receive()`.
+    **/
+    mailbox_stat_t select_responses(const std::string& command, mailbox_changes_t& changes);
+
+    /**
+    Parsing the vanished response held by the mandatory part.
+
+    @return           Removed UIDs, none if the response is not a vanished one.
+    @throw *          `messages_set_t::from_string(string_view)`.
+    **/
+    std::optional<messages_set_t> parse_vanished() const;
+
     /**
     Parsing a line into tag, result and response which is the rest of the line.
 
@@ -849,8 +1821,8 @@ protected:
     /**
     Parsing the string literal as defined by IMAP.
 
-    The method is unfortunately tied to the states controlled by `parse_grammar()` and the main loop iterator. It keeps the static variable to count string
-    characters read so far.
+    The method is unfortunately tied to the states controlled by `parse_grammar()` and the main loop iterator. The literal content is appended to the
+    token in whole line chunks, or passed to the literal sink if it is set.
 
     @param imap_string_end Past the end iterator of the IMAP response.
     @param cur_char        Current char while the IMAP grammar is being parsed.
@@ -882,11 +1854,210 @@ protected:
     **/
     bool is_start_tls_;
 
+    /**
+    Number of threads parsing the fetched messages, zero for the calling thread.
+    **/
+    unsigned parser_threads_;
+
     /**
     Tag used to identify requests and responses.
     **/
     unsigned tag_;
 
+    /**
+    Flag to stop the idling, set from another thread.
+    **/
+    std::atomic<bool> idle_stopped_;
+
+    /**
+    Capabilities announced by the server, if known.
+    **/
+    std::optional<std::vector<std::string>> capabilities_;
+
+    struct grammar_token_t;
+
+    /**
+    Sequence of tokens stored in the token arena, linked by their indexes.
+
+    The sequence does not own the tokens, so it is valid as long as the arena is not reset. Its iterator dereferences to the pointer of a token,
+    which is valid until a new token is added to the arena.
+    **/
+    class token_list_t
+    {
+    public:
+
+        /**
+        Index which denotes no token.
+        **/
+        static const std::size_t NO_TOKEN = static_cast<std::size_t>(-1);
+
+        /**
+        Iterator over the linked tokens.
+        **/
+        class iterator
+        {
+        public:
+
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = grammar_token_t*;
+            using difference_type = std::ptrdiff_t;
+            using pointer = grammar_token_t**;
+            using reference = grammar_token_t*;
+
+            /**
+            Setting the arena and the index of the token the iterator points to.
+
+            @param arena Arena of the tokens.
+            @param index Index of the token, `NO_TOKEN` for the end of the sequence.
+            **/
+            iterator(std::vector<grammar_token_t>* arena, std::size_t index);
+
+            /**
+            Getting the pointed token.
+
+            @return Token the iterator points to.
+            **/
+            grammar_token_t* operator*() const;
+
+            /**
+            Moving to the next token of the sequence.
+
+            @return This iterator.
+            **/
+            iterator& operator++();
+
+            /**
+            Moving to the next token of the sequence.
+
+            @return Iterator before the increment.
+            **/
+            iterator operator++(int);
+
+            /**
+            Comparing two iterators by their positions.
+
+            @param other Iterator to compare with.
+            @return      True if both point to the same token, false if not.
+            **/
+            bool operator==(const iterator& other) const;
+
+            /**
+            Comparing two iterators by their positions.
+
+            @param other Iterator to compare with.
+            @return      True if they point to different tokens, false if not.
+            **/
+            bool operator!=(const iterator& other) const;
+
+        private:
+
+            /**
+            Arena of the tokens.
+            **/
+            std::vector<grammar_token_t>* arena_;
+
+            /**
+            Index of the token the iterator points to.
+            **/
+            std::size_t index_;
+        };
+
+        /**
+        Creating an empty sequence of the given arena.
+
+        @param arena Arena of the tokens.
+        **/
+        explicit token_list_t(std::vector<grammar_token_t>* arena);
+
+        /**
+        Getting the iterator to the first token.
+
+        @return Iterator to the first token.
+        **/
+        iterator begin() const;
+
+        /**
+        Getting the iterator past the last token.
+
+        @return Iterator past the last token.
+        **/
+        iterator end() const;
+
+        /**
+        Getting the first token.
+
+        @return First token of the sequence.
+        **/
+        grammar_token_t* front() const;
+
+        /**
+        Getting the last token.
+
+        @return Last token of the sequence.
+        **/
+        grammar_token_t* back() const;
+
+        /**
+        Getting the arena index of the last token.
+
+        @return Index of the last token, `NO_TOKEN` if the sequence is empty.
+        **/
+        std::size_t back_index() const;
+
+        /**
+        Checking whether the sequence has no tokens.
+
+        @return True if the sequence is empty, false if not.
+        **/
+        bool empty() const;
+
+        /**
+        Getting the number of tokens.
+
+        @return Number of tokens in the sequence.
+        **/
+        std::size_t size() const;
+
+        /**
+        Appending the token to the end of the sequence.
+
+        @param index Arena index of the token to append.
+        **/
+        void push_back(std::size_t index);
+
+        /**
+        Removing the first token from the sequence, the token itself stays in the arena.
+        **/
+        void pop_front();
+
+        /**
+        Removing all tokens from the sequence.
+        **/
+        void clear();
+
+    private:
+
+        /**
+        Arena of the tokens.
+        **/
+        std::vector<grammar_token_t>* arena_;
+
+        /**
+        Index of the first token.
+        **/
+        std::size_t head_;
+
+        /**
+        Index of the last token.
+        **/
+        std::size_t tail_;
+
+        /**
+        Number of tokens in the sequence.
+        **/
+        std::size_t size_;
+    };
+
     /**
     Token of the response defined by the grammar.
 
@@ -901,44 +2072,73 @@ protected:
         enum class token_type_t {EMPTY, ATOM, LITERAL, LIST} token_type;
 
         /**
-        Token content in case it is atom.
+        Token content in case it is atom, viewing the response buffer.
         **/
-        std::string atom;
+        std::string_view atom;
 
         /**
         Token content in case it is string literal.
+
+        It is reserved to the literal size, so the consumers can take it by move once the literal is read.
         **/
         std::string literal;
 
         /**
         String literal is first determined by its size, so it's stored here before reading the literal itself.
         **/
-        std::string literal_size;
+        std::string::size_type literal_size;
 
         /**
         Token content in case it is parenthesized list.
 
         It can store either of the three types, so the definition is recursive.
         **/
-        std::list<std::shared_ptr<grammar_token_t>> parenthesized_list;
+        token_list_t parenthesized_list;
+
+        /**
+        Arena index of the next token in the same sequence.
+        **/
+        std::size_t next;
 
         /**
-        Default constructor.
+        Creating an empty token of the given arena.
+
+        @param arena Arena of the tokens, used by the parenthesized list.
         **/
-        grammar_token_t() : token_type(token_type_t::EMPTY)
+        explicit grammar_token_t(std::vector<grammar_token_t>* arena) : token_type(token_type_t::EMPTY), literal_size(0), parenthesized_list(arena),
+            next(token_list_t::NO_TOKEN)
         {
         }
     };
 
+    /**
+    Arena of the tokens of the current response.
+
+    The tokens are not released when the parser is reset, so their storage is reused by the next response.
+    **/
+    std::vector<grammar_token_t> token_arena_;
+
+    /**
+    Number of arena tokens used by the current response.
+    **/
+    std::size_t tokens_no_;
+
+    /**
+    Lines of the current response which the atoms are viewing.
+
+    The lines are kept as long as the response is parsed, and the string literal content is not stored here.
+    **/
+    std::deque<std::string> response_buffer_;
+
     /**
     Optional part of the response, determined by the square brackets.
     **/
-    std::list<std::shared_ptr<grammar_token_t>> optional_part_;
+    token_list_t optional_part_;
 
     /**
     Mandatory part of the response, which is any text outside of the square brackets.
     **/
-    std::list<std::shared_ptr<grammar_token_t>> mandatory_part_;
+    token_list_t mandatory_part_;
 
     /**
     Parser state if an optional part is reached.
@@ -960,6 +2160,16 @@ protected:
     **/
     enum class string_literal_state_t {NONE, READING} literal_state_;
 
+    /**
+    Number of bytes read so far while parsing a string literal.
+    **/
+    std::string::size_type literal_bytes_read_;
+
+    /**
+    Consumer of the literal chunks while streaming, if set then the literals are not stored in the tokens.
+    **/
+    std::function<void(const std::string&)> literal_sink_;
+
     /**
     Finding last token of the list at the given depth in terms of parenthesis count.
 
@@ -968,7 +2178,139 @@ protected:
     @param token_list Token sequence to traverse.
     @return           Last token of the given sequence at the current depth of parenthesis count.
     **/
-    std::list<std::shared_ptr<grammar_token_t>>* find_last_token_list(std::list<std::shared_ptr<grammar_token_t>>& token_list);
+    token_list_t* find_last_token_list(token_list_t& token_list);
+
+    /**
+    Taking the next token from the arena.
+
+    The token storage left from a previous response is reused, so the pointers to the arena tokens are invalidated only when the arena grows. A literal
+    storage larger than `TOKEN_LITERAL_MAX_CAPACITY` is released instead.
+
+    @param token_type Type of the new token.
+    @return           Arena index of the token.
+    **/
+    std::size_t make_token(grammar_token_t::token_type_t token_type);
+
+    /**
+    Making the fetch command for the given messages and options.
+
+    @param messages_range Range of message SIDs or UIDs to fetch.
+    @param options        Selected options when fetching a message.
+    @return               Fetch command without the tag.
+    @throw imap_error     Empty messages range.
+    **/
+    std::string fetch_command(const messages_set_t& messages_range, fetch_options_t options) const;
+
+    /**
+    Consumer of a complete fetch response, given the content of its body data item if the response has one and it is not streamed to the literal
+    sink. The content is given either as a literal or as a quoted string, and it is none for `NIL`.
+    **/
+    using fetch_literal_callback_t = std::function<void(const fetch_response_t&, std::string*)>;
+
+    /**
+    Sending the fetch command to an already selected mailbox, handing each complete response to the callback.
+
+    The callback may take the literal by move, since the tokens of the response are dropped once the callback returns.
+
+    @param command    Fetch command without the tag.
+    @param callback   Consumer of the fetch responses.
+    @throw imap_error Fetching message failure.
+    @throw *          `parse_tag_result(const string&)`, `parse_grammar(const string&)`, `parse_fetch_response()`, `dialog::send(const string&)`,
+                      `dialog::receive()`, exception of the callback once the tagged response is read.
+    **/
+    void fetch_responses(const std::string& command, const fetch_literal_callback_t& callback);
+
+    /**
+    Parsing the message attributes of the fetch response held by the mandatory part.
+
+    @return           Message attributes, or none if the response is not a fetch one.
+    @throw imap_error No uid number when fetching a message.
+    @throw imap_error Parsing failure.
+    **/
+    std::optional<fetch_response_t> parse_fetch_response() const;
+
+    /**
+    Fetching the content of a message body data item, given either as a literal or as a quoted string.
+
+    @param uid        UID of the message.
+    @param item       Body data item to fetch.
+    @return           Content of the data item.
+    @throw imap_error No message part.
+    @throw imap_error No message part content.
+    @throw *          `fetch_responses(const string&, const fetch_literal_callback_t&)`.
+    **/
+    std::string fetch_body_item(unsigned long uid, const std::string& item);
+
+    /**
+    Fetching the size of a message or of its part as announced by the server.
+
+    @param uid        UID of the message.
+    @param section    Section of the part, empty for the whole message.
+    @return           Size in octets, none if the section is not a numbered single part.
+    @throw imap_error Parsing failure.
+    @throw *          `fetch_responses(const string&, const fetch_literal_callback_t&)`, `fetch_structure(const messages_set_t&, bool)`.
+    **/
+    std::optional<unsigned long> announced_size(unsigned long uid, const std::string& section);
+
+    /**
+    Finding the value of a message data item of the fetch response held by the mandatory part.
+
+    @param item_name Name of the data item.
+    @return          Token following the item name, null pointer if there is no such item.
+    **/
+    grammar_token_t* find_fetch_item(const std::string& item_name) const;
+
+    /**
+    Finding the value of the body data item of the fetch response held by the mandatory part.
+
+    The body data items are `BODY` and `BINARY` with a section, followed by the origin octet in a partial fetch, and the `RFC822` ones except
+    `RFC822.SIZE`.
+
+    @return Token following the item name and the origin octet, null pointer if there is no such item.
+    **/
+    grammar_token_t* find_body_item() const;
+
+    /**
+    Parsing the body structure of a message or of a message part.
+
+    @param body       Parenthesized list of the body structure.
+    @param section    Section of the part, empty for the message itself.
+    @param part       Part to store the parsed structure.
+    @throw imap_error Parsing failure.
+    **/
+    void parse_body_structure(const grammar_token_t& body, const std::string& section, body_part_t& part) const;
+
+    /**
+    Parsing the message envelope into the summary.
+
+    @param envelope   Parenthesized list of the envelope.
+    @param summary    Summary to store the envelope fields.
+    @throw imap_error Parsing failure.
+    **/
+    void parse_envelope(const grammar_token_t& envelope, message_summary_t& summary) const;
+
+    /**
+    Parsing the header fields returned by the server, without parsing the whole header.
+
+    @param header Header lines of the fetched fields.
+    @param fields Fields mapped by their names in lower case.
+    **/
+    static void parse_header_fields(const std::string& header, std::map<std::string, std::string>& fields);
+
+    /**
+    Getting the string value of a token, which is either an atom or a string literal.
+
+    @param token Token to get the value from.
+    @return      Value of the token, empty for the `NIL` atom or a list.
+    **/
+    static std::string token_string(const grammar_token_t& token);
+
+    /**
+    Storing the capabilities from parsed tokens, following the `CAPABILITY` atom.
+
+    @param tokens Parsed tokens whose first atom is `CAPABILITY`.
+    **/
+    void store_capabilities(const token_list_t& tokens);
 
     /**
     Keeping the number of end-of-line characters to be counted as additionals to a formatted line.
@@ -998,8 +2340,12 @@ public:
     The following mechanisms are allowed:
     - LOGIN: The username and password are sent in plain format.
     - START_TLS: For the TCP connection, a TLS negotiation is asked before sending the login parameters.
+    - PLAIN: The username and password are sent by the `AUTHENTICATE PLAIN` command, as for `imap::auth_method_t::PLAIN`.
+    - XOAUTH2: The username and OAuth2 access token (given as the password) are sent by the `AUTHENTICATE XOAUTH2` command.
+    - START_TLS_PLAIN: The plain mechanism after the TLS negotiation.
+    - START_TLS_XOAUTH2: The XOAUTH2 mechanism after the TLS negotiation.
     **/
-    enum class auth_method_t {LOGIN, START_TLS};
+    enum class auth_method_t {LOGIN, START_TLS, PLAIN, XOAUTH2, START_TLS_PLAIN, START_TLS_XOAUTH2};
 
     /**
     Making a connection to the server.
@@ -1034,7 +2380,7 @@ public:
     @param username Username to authenticate.
     @param password Password to authenticate.
     @param method   Authentication method to use.
-    @throw *        `connect()`, `dialog::to_ssl()`, `start_tls()`, `auth_login(const std::string&, const std::string&)`.
+    @throw *        `imap::authenticate(const std::string&, const std::string&, imap::auth_method_t)`.
     **/
     std::string authenticate(const std::string& username, const std::string& password, auth_method_t method);
 
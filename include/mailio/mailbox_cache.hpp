@@ -0,0 +1,300 @@
+/*
+
+mailbox_cache.hpp
+-----------------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#pragma once
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable:4251)
+#endif
+
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "imap.hpp"
+#include "export.hpp"
+
+
+namespace mailio
+{
+
+
+/**
+Local index of an IMAP mailbox, kept by the message UIDs and synchronized with the server by fetching only what has changed.
+
+The index keeps the UID validity, the next UID and the summaries of the messages, and it is stored in a file so it survives the connection. When the
+UID validity changes, the UIDs of the index are not valid anymore, so the index is rebuilt. Otherwise, only the messages with UIDs greater than the known
+next UID are fetched, the flags are fetched by the CONDSTORE changes if the server reports the modification sequences, and the removed messages are
+detected by comparing the number of messages.
+
+Optionally, the messages are downloaded into the store directory, each one into the file named by its UID.
+**/
+class MAILIO_EXPORT mailbox_cache
+{
+public:
+
+    /**
+    Message summaries mapped by the UIDs.
+    **/
+    using messages_t = std::map<unsigned long, imap::message_summary_t>;
+
+    /**
+    Changes of the index made by a synchronization.
+    **/
+    struct sync_result_t
+    {
+        /**
+        Flag if the index was rebuilt because the UID validity changed.
+        **/
+        bool is_reset = false;
+
+        /**
+        UIDs of the new messages.
+        **/
+        std::vector<unsigned long> added;
+
+        /**
+        UIDs of the removed messages.
+        **/
+        std::vector<unsigned long> removed;
+
+        /**
+        UIDs of the messages with changed flags.
+        **/
+        std::vector<unsigned long> changed;
+    };
+
+    /**
+    Making the index of the mailbox, loading it from the index file if the file exists.
+
+    @param mailbox       Mailbox name.
+    @param index_path    Path of the index file.
+    @param store_path    Directory to download the messages into, empty if the messages are not downloaded.
+    @param header_fields Names of the header fields to keep in the summaries in addition to the envelope.
+    @throw *             `load(istream&)`.
+    **/
+    mailbox_cache(const std::string& mailbox, const std::string& index_path, const std::string& store_path = "",
+        const std::vector<std::string>& header_fields = {});
+
+    mailbox_cache(const mailbox_cache&) = delete;
+
+    mailbox_cache(mailbox_cache&&) = default;
+
+    /**
+    Default destructor.
+    **/
+    ~mailbox_cache() = default;
+
+    mailbox_cache& operator=(const mailbox_cache&) = delete;
+
+    mailbox_cache& operator=(mailbox_cache&&) = default;
+
+    /**
+    Synchronizing the index with the server, and storing it into the index file.
+
+    The mailbox is examined, so it remains selected as read only.
+
+    @param connection          Authenticated connection to the server.
+    @return                    Changes of the index.
+    @throw mailbox_cache_error No UID validity.
+    @throw *                   `imap::select(const string&, bool)`, `imap::fetch_summaries(const imap::messages_set_t&, bool, const vector<string>&)`,
+                               `imap::fetch_flags(const imap::messages_set_t&, bool)`, `imap::fetch_changes(const imap::messages_set_t&,
+                               unsigned long long, bool)`, `imap::search(const list<search_condition_t>&, unsigned int, bool)`,
+                               `imap::download(unsigned long, const range_sink_t&, unsigned long, unsigned long, const string&)`, `save()`.
+    **/
+    sync_result_t synchronize(imap& connection);
+
+    /**
+    Storing the index into the index file.
+
+    The index is written into a temporary file first, which replaces the index file once written, so a failure does not leave a broken index.
+
+    @throw mailbox_cache_error Writing index failure.
+    **/
+    void save() const;
+
+    /**
+    Getting the message summaries.
+
+    @return Message summaries mapped by the UIDs.
+    **/
+    const messages_t& messages() const;
+
+    /**
+    Getting the UID validity of the index.
+
+    @return UID validity, zero if the index is not synchronized yet.
+    **/
+    unsigned long uid_validity() const;
+
+    /**
+    Getting the next UID of the index.
+
+    @return Next UID, zero if the index is not synchronized yet.
+    **/
+    unsigned long uid_next() const;
+
+    /**
+    Getting the highest modification sequence of the index.
+
+    @return Highest modification sequence, zero if the server does not report it.
+    **/
+    unsigned long long highest_modseq() const;
+
+    /**
+    Getting the path of a downloaded message.
+
+    @param uid UID of the message.
+    @return    Path of the message file, empty if the messages are not downloaded.
+    **/
+    std::string message_path(unsigned long uid) const;
+
+protected:
+
+    /**
+    Reading the index.
+
+    @param input               Stream to read from.
+    @throw mailbox_cache_error Parsing index failure.
+    **/
+    void load(std::istream& input);
+
+    /**
+    Writing the index.
+
+    @param output Stream to write to.
+    **/
+    void store(std::ostream& output) const;
+
+    /**
+    Escaping the backslash and the line breaking characters of a value in the index.
+
+    @param value Value to escape.
+    @return      Escaped value.
+    **/
+    static std::string escape(const std::string& value);
+
+    /**
+    Reverting the escaping of a value in the index.
+
+    @param value Value to unescape.
+    @return      Unescaped value.
+    **/
+    static std::string unescape(const std::string& value);
+
+    /**
+    Removing messages from the index and from the store.
+
+    @param uids UIDs of the messages to remove.
+    **/
+    void remove(const std::vector<unsigned long>& uids);
+
+    /**
+    Downloading a message into the store.
+
+    @param connection Connection with the mailbox selected.
+    @param uid        UID of the message.
+    @throw *          `imap::download(unsigned long, const range_sink_t&, unsigned long, unsigned long, const string&)`.
+    **/
+    void download(imap& connection, unsigned long uid) const;
+
+    /**
+    Tag of the index file format.
+    **/
+    static const std::string INDEX_TAG;
+
+    /**
+    Mailbox name.
+    **/
+    std::string mailbox_;
+
+    /**
+    Path of the index file.
+    **/
+    std::string index_path_;
+
+    /**
+    Directory of the downloaded messages.
+    **/
+    std::string store_path_;
+
+    /**
+    Header fields kept in the summaries.
+    **/
+    std::vector<std::string> header_fields_;
+
+    /**
+    UID validity of the index.
+    **/
+    unsigned long uid_validity_;
+
+    /**
+    Next UID of the index.
+    **/
+    unsigned long uid_next_;
+
+    /**
+    Highest modification sequence of the index.
+    **/
+    unsigned long long highest_modseq_;
+
+    /**
+    Message summaries mapped by the UIDs.
+    **/
+    messages_t messages_;
+};
+
+
+/**
+Error thrown by the mailbox index.
+**/
+class mailbox_cache_error : public imap_error
+{
+public:
+
+    /**
+    Calling parent constructor.
+
+    @param msg     Error message.
+    @param details Detailed message.
+    **/
+    mailbox_cache_error(const std::string& msg, const std::string& details);
+
+    /**
+    Calling parent constructor.
+
+    @param msg     Error message.
+    @param details Detailed message.
+    **/
+    explicit mailbox_cache_error(const char* msg, const std::string& details);
+
+    mailbox_cache_error(const mailbox_cache_error&) = default;
+
+    mailbox_cache_error(mailbox_cache_error&&) = default;
+
+    ~mailbox_cache_error() = default;
+
+    mailbox_cache_error& operator=(const mailbox_cache_error&) = default;
+
+    mailbox_cache_error& operator=(mailbox_cache_error&&) = default;
+};
+
+
+} // namespace mailio
+
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -120,6 +120,28 @@ public:
     **/
     void format(std::string& message_str, const message_format_options_t& opts = message_format_options_t{}) const;
 
+    /**
+    Formatting the message chunk by chunk.
+
+    The chunks are passed to the sink as soon as they are formatted, so the whole message is not built in memory.
+
+    @param sink Consumer of the formatted chunks.
+    @param opts Options to customize formatting.
+    @throw *    `format_header(format_options)`, `format_content(bool)`, `mime::format(const format_sink_t&, bool)`.
+    **/
+    void format(const format_sink_t& sink, const message_format_options_t& opts = message_format_options_t{}) const;
+
+    /**
+    Calculating the length of the formatted message without formatting it.
+
+    The length can be given to the SMTP `SIZE` extension or to the IMAP append literal before the message is formatted.
+
+    @param opts Options to customize formatting.
+    @return     Length in octets of the message formatted by `format(string&, const message_format_options_t&)`.
+    @throw *    `format_header(bool)`, `mime::formatted_content_size(bool)`, `mime::formatted_size(bool)`.
+    **/
+    std::string::size_type formatted_size(const message_format_options_t& opts = message_format_options_t{}) const;
+
     /**
     Overload of `format(string&, const message_format_options&)`.
 
@@ -525,6 +547,11 @@ public:
 
 protected:
 
+    /**
+    Template formats the header and the content separately.
+    **/
+    friend class message_template;
+
     /**
     Printable ASCII characters without the alphanumerics, double quote, comma, colon, semicolon, angle and square brackets and monkey.
     **/
@@ -611,6 +638,13 @@ protected:
     **/
     virtual std::string format_header(bool add_bcc_header) const;
 
+    /**
+    Making the part of a multipart message which carries the message content.
+
+    @return Text part with the message content, charset, encoding and codec options.
+    **/
+    mime make_content_part() const;
+
     /**
     Parsing a header line for a specific header.
 
@@ -791,6 +825,192 @@ protected:
     std::vector<std::string> flags_;
 };
 
+
+/**
+Message formatted once for the repeated submission.
+
+The message is formatted with the leading dots escaped, so it can be sent as it is over any number of SMTP transactions or appended to IMAP folders
+without formatting it again. Along with the content, the envelope addresses are kept. The object cannot be changed after construction.
+**/
+class MAILIO_EXPORT formatted_message
+{
+public:
+
+    /**
+    Header an envelope recipient is taken from, and whether it is a group.
+    **/
+    enum class recipient_kind_t {RECIPIENT, GROUP_RECIPIENT, CC_RECIPIENT, GROUP_CC_RECIPIENT, BCC_RECIPIENT, GROUP_BCC_RECIPIENT};
+
+    /**
+    Envelope addresses of a message.
+    **/
+    struct envelope_t
+    {
+        /**
+        Envelope sender address.
+        **/
+        std::string sender;
+
+        /**
+        Envelope recipient addresses, in the order of `envelope_recipients(const message&)`.
+        **/
+        std::vector<std::string> recipients;
+
+        /**
+        Kinds of the envelope recipients, in the same order as the addresses.
+        **/
+        std::vector<recipient_kind_t> recipient_kinds;
+    };
+
+    /**
+    Formatting the given message.
+
+    @param msg            Message to format.
+    @param add_bcc_header Flag whether bcc addresses should be added to the header.
+    @throw *              `message::format(string&, const message_format_options_t&)`.
+    **/
+    explicit formatted_message(const message& msg, bool add_bcc_header = false);
+
+    /**
+    Default copy constructor.
+    **/
+    formatted_message(const formatted_message&) = default;
+
+    /**
+    Default move constructor.
+    **/
+    formatted_message(formatted_message&&) = default;
+
+    /**
+    Default destructor.
+    **/
+    ~formatted_message() = default;
+
+    formatted_message& operator=(const formatted_message&) = delete;
+
+    formatted_message& operator=(formatted_message&&) = delete;
+
+    /**
+    Getting the formatted message.
+
+    @return Message with the escaped leading dots, without the terminating end of line.
+    **/
+    const std::string& content() const;
+
+    /**
+    Getting the size of the formatted message, as declared to the SMTP `SIZE` extension.
+
+    @return Number of characters of the formatted message without the escaped leading dots.
+    **/
+    std::string::size_type size() const;
+
+    /**
+    Getting the envelope sender.
+
+    @return Sender address if set, otherwise the first author address. Empty if there is no author.
+    **/
+    const std::string& sender() const;
+
+    /**
+    Getting the envelope recipients.
+
+    @return Recipients, cc recipients and bcc recipients in that order, each list given as the addresses followed by the group names.
+    **/
+    const std::vector<std::string>& recipients() const;
+
+    /**
+    Getting the envelope addresses.
+
+    @return Sender and recipients along with the recipient kinds.
+    **/
+    const envelope_t& envelope() const;
+
+    /**
+    Determining the envelope addresses of a message.
+
+    @param msg Message to determine the addresses.
+    @return    Sender as by `envelope_sender(const message&)`, and recipients with their kinds as by `envelope_recipient_kinds(const message&)`.
+    **/
+    static envelope_t make_envelope(const message& msg);
+
+    /**
+    Determining the envelope sender of a message.
+
+    @param msg Message to determine the sender.
+    @return    Sender address if set, otherwise the first author address. Empty if there is no author.
+    **/
+    static std::string envelope_sender(const message& msg);
+
+    /**
+    Collecting the envelope recipients of a message.
+
+    @param msg Message to collect the recipients.
+    @return    Recipients, cc recipients and bcc recipients in that order, each list given as the addresses followed by the group names.
+    **/
+    static std::vector<std::string> envelope_recipients(const message& msg);
+
+    /**
+    Collecting the envelope recipients of a message along with their kinds.
+
+    @param msg Message to collect the recipients.
+    @return    Recipients in the order of `envelope_recipients(const message&)`, each paired with its kind.
+    **/
+    static std::vector<std::pair<std::string, recipient_kind_t>> envelope_recipient_kinds(const message& msg);
+
+private:
+
+    /**
+    Template renders the message content by itself.
+    **/
+    friend class message_template;
+
+    /**
+    Signer formats the message by itself, hashing it along.
+    **/
+    friend class dkim_signer;
+
+    /**
+    Initializing the already formatted message.
+
+    @param content  Formatted message with the escaped leading dots.
+    @param envelope Envelope addresses.
+    **/
+    formatted_message(std::string content, envelope_t envelope);
+
+    /**
+    Formatting the message content with the leading dots escaped.
+
+    @param msg            Message to format.
+    @param add_bcc_header Flag whether bcc addresses should be added to the header.
+    @return               Formatted message.
+    @throw *              `message::format(string&, const message_format_options_t&)`.
+    **/
+    static std::string format_content(const message& msg, bool add_bcc_header);
+
+    /**
+    Calculating the size of a formatted message without the escaped leading dots.
+
+    @param content Formatted message with the escaped leading dots.
+    @return        Number of characters without the escaped leading dots.
+    **/
+    static std::string::size_type unescaped_size(const std::string& content);
+
+    /**
+    Formatted message content.
+    **/
+    const std::string content_;
+
+    /**
+    Size of the formatted message without the escaped leading dots.
+    **/
+    const std::string::size_type size_;
+
+    /**
+    Envelope addresses.
+    **/
+    const envelope_t envelope_;
+};
+
 [[deprecated]]
 typedef mime_error message_error;
 
@@ -0,0 +1,246 @@
+/*
+
+message_template.hpp
+--------------------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#pragma once
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable:4251)
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <optional>
+#include "mime.hpp"
+#include "message.hpp"
+#include "mailboxes.hpp"
+#include "export.hpp"
+
+
+namespace mailio
+{
+
+
+/**
+Message formatted once with the placeholders, for rendering many messages which differ only in the recipients and the substituted fields.
+
+A placeholder is the field name enclosed by the delimiters, like `{{name}}`, and it may occur in the subject and in the content of the message and of its
+parts. Parts without placeholders are formatted once when the template is made, and copied as they are on each rendering. The seven bit, eight bit and
+quoted printable codecs encode each line on its own, so in a content with placeholders only the lines containing them are encoded on each rendering, and
+the other lines are encoded once. The header, and the Base64 or binary parts with placeholders, are formatted again on each rendering.
+
+The rendered message is sent only to the recipients given to the rendering, so the cc and bcc recipients of the template message are dropped.
+**/
+class MAILIO_EXPORT message_template
+{
+public:
+
+    /**
+    Substituted values mapped by the field names.
+    **/
+    using fields_t = std::map<std::string, std::string>;
+
+    /**
+    Making the template of the given message.
+
+    @param msg         Message with the placeholders.
+    @param field_begin Delimiter which starts a placeholder.
+    @param field_end   Delimiter which ends a placeholder.
+    @throw mime_error  Empty field delimiter.
+    @throw *           `mime::format(string&, bool)`.
+    **/
+    message_template(const message& msg, const std::string& field_begin = "{{", const std::string& field_end = "}}");
+
+    /**
+    Default copy constructor.
+    **/
+    message_template(const message_template&) = default;
+
+    /**
+    Default move constructor.
+    **/
+    message_template(message_template&&) = default;
+
+    /**
+    Default destructor.
+    **/
+    ~message_template() = default;
+
+    message_template& operator=(const message_template&) = delete;
+
+    message_template& operator=(message_template&&) = delete;
+
+    /**
+    Rendering the message for the given recipients.
+
+    @param recipients Recipients of the rendered message, replacing the ones of the template.
+    @param fields     Values to substitute the placeholders.
+    @return           Formatted message with the escaped leading dots.
+    @throw mime_error Missing template field.
+    @throw *          `message::format_header(bool)`, `mime::format_content(bool)`, `mime::format(string&, bool)`.
+    **/
+    formatted_message render(const mailboxes& recipients, const fields_t& fields) const;
+
+private:
+
+    /**
+    Content split at the lines containing placeholders.
+    **/
+    struct content_t
+    {
+        /**
+        Lines without placeholders formatted with the escaped leading dots, the first ones before the first lines with placeholders, and each of the
+        others after the lines with placeholders of the same index.
+        **/
+        std::vector<std::string> formatted;
+
+        /**
+        Lines with placeholders, not encoded.
+        **/
+        std::vector<std::string> texts;
+    };
+
+    /**
+    Formatted part, or the part itself if it has to be formatted on each rendering.
+    **/
+    struct segment_t
+    {
+        /**
+        Part formatted with the escaped leading dots, or only its header if its content is split. Empty if the part is formatted on each rendering.
+        **/
+        std::string formatted;
+
+        /**
+        Part containing placeholders formatted on each rendering, or the part without the content whose codec encodes the split content.
+        **/
+        std::optional<mime> part;
+
+        /**
+        Split content of the part.
+        **/
+        std::optional<content_t> content;
+    };
+
+    /**
+    Making the segment of a part.
+
+    @param part Part to make the segment of.
+    @return     Segment of the part.
+    @throw *    `mime::format(string&, bool)`, `split_content(const mime&)`.
+    **/
+    segment_t make_segment(const mime& part) const;
+
+    /**
+    Splitting the content of a part at the lines containing placeholders, and formatting the other lines.
+
+    @param part Part with the content to split.
+    @return     Split content, none if the codec of the part does not encode each line on its own.
+    @throw *    `format_lines(const mime&, const string&)`.
+    **/
+    std::optional<content_t> split_content(const mime& part) const;
+
+    /**
+    Rendering the split content.
+
+    @param encoder Part whose codec encodes the content.
+    @param content Split content.
+    @param fields  Values to substitute the placeholders.
+    @param msg_str String to append the formatted content to.
+    @throw *       `substitute(const string&, const fields_t&)`, `format_lines(const mime&, const string&)`.
+    **/
+    void render_content(const mime& encoder, const content_t& content, const fields_t& fields, std::string& msg_str) const;
+
+    /**
+    Encoding whole lines of a content and formatting them with the escaped leading dots.
+
+    @param encoder Part whose codec encodes the lines.
+    @param text    Lines to encode, each ending by the end of line except possibly the last one.
+    @return        Formatted lines, keeping the trailing empty ones.
+    @throw *       `mime::encode_content(const string&)`.
+    **/
+    static std::string format_lines(const mime& encoder, const std::string& text);
+
+    /**
+    Checking if a text contains a placeholder.
+
+    @param text Text to check.
+    @return     True if the placeholder begin delimiter is found, false if not.
+    **/
+    bool has_placeholder(const std::string& text) const;
+
+    /**
+    Checking recursively if a part contains a placeholder in its content.
+
+    @param part Part to check.
+    @return     True if any content contains a placeholder, false if not.
+    **/
+    bool has_placeholder(const mime& part) const;
+
+    /**
+    Substituting the placeholders of a text.
+
+    @param text       Text with the placeholders.
+    @param fields     Values to substitute the placeholders.
+    @return           Text with the substituted values.
+    @throw mime_error Missing template field.
+    **/
+    std::string substitute(const std::string& text, const fields_t& fields) const;
+
+    /**
+    Substituting recursively the placeholders in the content of a part.
+
+    @param part   Part to substitute.
+    @param fields Values to substitute the placeholders.
+    @throw *      `substitute(const string&, const fields_t&)`.
+    **/
+    void substitute(mime& part, const fields_t& fields) const;
+
+    /**
+    Placeholder begin delimiter.
+    **/
+    const std::string field_begin_;
+
+    /**
+    Placeholder end delimiter.
+    **/
+    const std::string field_end_;
+
+    /**
+    Message without parts, used to format the header and the content.
+    **/
+    message header_;
+
+    /**
+    Formatted content of a message without parts if the content contains no placeholders, none if it has to be formatted on each rendering.
+    **/
+    std::optional<std::string> content_;
+
+    /**
+    Split content of a message without parts, if the content contains placeholders.
+    **/
+    std::optional<content_t> split_content_;
+
+    /**
+    Parts of a multipart message, including the message content as the first part if any.
+    **/
+    std::vector<segment_t> segments_;
+};
+
+
+} // namespace mailio
+
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
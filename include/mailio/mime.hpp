@@ -19,6 +19,7 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 #endif
 
 #include <string>
+#include <functional>
 #include <utility>
 #include <vector>
 #include <stdexcept>
@@ -238,6 +239,11 @@ public:
     **/
     enum class content_disposition_t {NONE, INLINE, ATTACHMENT};
 
+    /**
+    Consumer of the formatted chunks, called in the order of formatting.
+    **/
+    using format_sink_t = std::function<void(const std::string&)>;
+
     /**
     Default constructor.
     **/
@@ -280,6 +286,37 @@ public:
     **/
     void format(std::string& mime_str, bool dot_escape = true) const;
 
+    /**
+    Formatting the mime part chunk by chunk.
+
+    The chunks are passed to the sink as soon as they are formatted, so the whole mime part is not built in memory.
+
+    @param sink        Consumer of the formatted chunks.
+    @param dot_escape  Flag if the leading dot should be escaped.
+    @throw mime_error  Formatting failure, non multipart message with boundary.
+    @throw *           `format_header()`, `format_content(bool)`.
+    **/
+    void format(const format_sink_t& sink, bool dot_escape = true) const;
+
+    /**
+    Calculating the length of the formatted mime part without formatting it.
+
+    Base64 content length is calculated from the content length and the line policy, other encodings are formatted part by part to be measured.
+
+    @param dot_escape  Flag if the leading dot should be escaped.
+    @return            Length in octets of the mime part formatted by `format(string&, bool)`.
+    @throw mime_error  Formatting failure, non multipart message with boundary.
+    @throw *           `format_header()`, `formatted_content_size(bool)`.
+    **/
+    std::string::size_type formatted_size(bool dot_escape = true) const;
+
+    /**
+    Checking if the length of the formatted mime part is calculated without encoding any content.
+
+    @return True if each content, of the part and of its subparts, is empty or Base64 encoded by a line policy, false if not.
+    **/
+    bool formatted_size_computable() const;
+
     /**
     Overload of `format(string&, bool)`.
 
@@ -542,6 +579,11 @@ public:
 
 protected:
 
+    /**
+    Template substitutes the content of parts without formatting them again.
+    **/
+    friend class message_template;
+
     /**
     Headers multimap with the custom comparator.
     **/
@@ -657,6 +699,11 @@ protected:
     **/
     static const std::string BOUNDARY_DELIMITER;
 
+    /**
+    Number of content octets encoded at once when formatting to a sink.
+    **/
+    static const std::string::size_type FORMAT_SLICE_LEN = 16384;
+
     /**
     Alphanumerics plus some special character allowed in the quoted text.
     **/
@@ -735,6 +782,36 @@ protected:
     **/
     std::string format_content(bool dot_escape) const;
 
+    /**
+    Encoding a text by the codec of the content transfer encoding.
+
+    @param text Text to encode.
+    @return     Encoded lines.
+    @throw *    `bit7::encode(const string&)`, `bit8::encode(const string&)`, `base64::encode(const string&)`, `quoted_printable::encode(const string&)`.
+    **/
+    std::vector<std::string> encode_content(const std::string& text) const;
+
+    /**
+    Formatting content by using the codec, slice by slice if possible.
+
+    Base64 content is encoded in slices of whole lines, so the encoded content is never entirely in memory. Other encodings depend on the content lines
+    as a whole, so the content is passed to the sink at once.
+
+    @param sink       Consumer of the formatted content.
+    @param dot_escape Flag if leading dots in lines should be escaped.
+    @throw *          `format_content(bool)`, `base64::encode(const string&)`.
+    **/
+    void format_content(const format_sink_t& sink, bool dot_escape) const;
+
+    /**
+    Calculating the length of the formatted content.
+
+    @param dot_escape Flag if leading dots in lines should be escaped.
+    @return           Length in octets of the content formatted by `format_content(bool)`.
+    @throw *          `format_content(bool)`.
+    **/
+    std::string::size_type formatted_content_size(bool dot_escape) const;
+
     /**
     Formatting content type to a string.
 
@@ -20,6 +20,7 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 
 #include <string>
 #include <vector>
+#include <list>
 #include <map>
 #include <utility>
 #include <istream>
@@ -178,6 +179,20 @@ public:
     **/
     void fetch(unsigned long message_no, message& msg, bool header_only = false);
 
+    /**
+    Fetching many messages.
+
+    The messages are retrieved one after another. If parser threads are set, then each message is parsed concurrently while the next one is being
+    retrieved, with at most two messages per thread buffered as the received lines. Otherwise, each message is parsed line by line as it is received.
+    Messages whose header cannot be fetched are left out, as with the single message fetching.
+
+    @param messages    Message numbers to fetch.
+    @param header_only Flag if only the message headers should be fetched.
+    @return            Fetched messages indexed by the message number.
+    @throw *           `request_message(unsigned long, bool)`, `receive_message(bool, message&)`, `parse_message(const vector<string>&, bool, message&)`.
+    **/
+    std::map<unsigned long, message> fetch(const std::list<unsigned long>& messages, bool header_only = false);
+
     /**
     Removing a message in the mailbox.
 
@@ -201,6 +216,13 @@ public:
     **/
     void ssl_options(const std::optional<dialog_ssl::ssl_options_t> options = std::nullopt);
 
+    /**
+    Setting the number of threads parsing the fetched messages.
+
+    @param threads Number of parsing threads. If zero, then the messages are parsed on the calling thread.
+    **/
+    void parser_threads(unsigned threads);
+
 protected:
 
     /**
@@ -245,6 +267,63 @@ protected:
     **/
     std::tuple<std::string, std::string> parse_status(const std::string& line);
 
+    /**
+    Requesting a message to retrieve.
+
+    @param message_no  Message number to retrieve.
+    @param header_only Flag if only the message header should be retrieved.
+    @return            True if the message follows, false if the header cannot be retrieved.
+    @throw pop3_error  Fetching message failure.
+    @throw *           `parse_status(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    bool request_message(unsigned long message_no, bool header_only);
+
+    /**
+    Parsing the requested message line by line as it is received, up to the end of message line.
+
+    @param header_only Flag if only the message header is retrieved.
+    @param msg         Message to parse into.
+    @throw *           `dialog::receive()`, `parse_line(const string&, bool&, message&)`, `parse_end(bool, message&)`.
+    **/
+    void receive_message(bool header_only, message& msg);
+
+    /**
+    Receiving the lines of the requested message, up to the end of message line.
+
+    @return  Message lines without the end of message line.
+    @throw * `dialog::receive()`.
+    **/
+    std::vector<std::string> receive_lines();
+
+    /**
+    Parsing the received message lines.
+
+    @param lines       Message lines without the end of message line.
+    @param header_only Flag if only the message header is retrieved.
+    @param msg         Message to parse into.
+    @throw *           `parse_line(const string&, bool&, message&)`, `parse_end(bool, message&)`.
+    **/
+    static void parse_message(const std::vector<std::string>& lines, bool header_only, message& msg);
+
+    /**
+    Parsing a message line, deferring an empty line until it is known not to be the last one.
+
+    @param line       Message line to parse.
+    @param empty_line Flag if the previous line is empty and deferred.
+    @param msg        Message to parse into.
+    @throw *          `mime::parse_by_line(const string&, bool)`.
+    **/
+    static void parse_line(const std::string& line, bool& empty_line, message& msg);
+
+    /**
+    Finishing the message parsing at the end of message line.
+
+    @param header_only Flag if only the message header is retrieved.
+    @param msg         Message to parse into.
+    @throw *           `mime::parse_by_line(const string&, bool)`.
+    **/
+    static void parse_end(bool header_only, message& msg);
+
     /**
     Dialog to use for send/receive operations.
     **/
@@ -259,6 +338,11 @@ protected:
     Flag to switch to the TLS.
     **/
     bool is_start_tls_;
+
+    /**
+    Number of threads parsing the fetched messages, zero for the calling thread.
+    **/
+    unsigned parser_threads_;
 };
 
 
@@ -21,9 +21,13 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 #include <string>
 #include <memory>
 #include <tuple>
+#include <map>
+#include <utility>
+#include <vector>
 #include <stdexcept>
 #include <chrono>
 #include <optional>
+#include <functional>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/asio/streambuf.hpp>
@@ -58,8 +62,67 @@ public:
     - NONE: No username or password are required, so just use the empty strings when authenticating. Nowadays, it's not probably that such authentication
       mechanism is allowed.
     - LOGIN: The username and password are sent in Base64 format.
+    - PLAIN: The username and password are sent in Base64 format as the initial response of the `AUTH` command, so a single round trip is needed. If the
+      server advertises the login mechanism but not the plain one, then the login mechanism is used instead.
+    - XOAUTH2: The username and OAuth2 access token (given as the password) are sent as the initial response of the `AUTH` command.
     **/
-    enum class auth_method_t {NONE, LOGIN};
+    enum class auth_method_t {NONE, LOGIN, PLAIN, XOAUTH2};
+
+    /**
+    Status of a single recipient as replied by the server.
+    **/
+    struct MAILIO_EXPORT recipient_status_t
+    {
+        /**
+        Recipient address as given to the `RCPT TO` command.
+        **/
+        std::string address;
+
+        /**
+        Status number of the server reply.
+        **/
+        int status;
+
+        /**
+        Status message of the server reply.
+        **/
+        std::string response;
+
+        /**
+        Checking if the recipient is accepted by the server.
+
+        @return True if the status is 2XX, false if not.
+        **/
+        bool accepted() const;
+    };
+
+    /**
+    Report of the message submission which tolerates the rejected recipients.
+    **/
+    struct MAILIO_EXPORT submit_report_t
+    {
+        /**
+        Statuses of the envelope recipients, in the order they are given to the server.
+        **/
+        std::vector<recipient_status_t> recipients;
+
+        /**
+        Status number of the server reply on the message content, zero if the message content is not sent.
+        **/
+        int status = 0;
+
+        /**
+        Status message of the server reply on the message content.
+        **/
+        std::string response;
+
+        /**
+        Checking if the message is accepted by the server for at least one recipient.
+
+        @return True if the message content is accepted, false if not.
+        **/
+        bool accepted() const;
+    };
 
     /**
     Making a connection to the server.
@@ -94,7 +157,8 @@ public:
     @param password Password to authenticate.
     @param method   Authentication method to use.
     @return         The server greeting message.
-    @throw *        `connect()`, `ehlo()`, `auth_login(const string&, const string&)`.
+    @throw *        `connect()`, `ehlo()`, `auth_login(const string&, const string&)`, `auth_plain(const string&, const string&)`,
+                    `auth_xoauth2(const string&, const string&)`.
     **/
     std::string authenticate(const std::string& username, const std::string& password, auth_method_t method);
 
@@ -111,10 +175,49 @@ public:
     @throw smtp_error Mail bcc recipient rejection.
     @throw smtp_error Mail group bcc recipient rejection.
     @throw smtp_error Mail message rejection.
-    @throw *          `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    @throw *          `mail_from(const string&, string::size_type)`, `declared_size(const message&)`, `data(const message&)`, `parse_line(const string&)`,
+                      `dialog::send(const string&)`, `dialog::receive()`.
     **/
     std::string submit(const message& msg);
 
+    /**
+    Submitting an already formatted message.
+
+    The message is not formatted again, so it can be submitted over many transactions and connections at the cost of a single formatting.
+
+    @param msg        Formatted message to send.
+    @return           The SMTP server's reply on accepting the message.
+    @throw smtp_error Mail sender rejection.
+    @throw smtp_error Mail recipient rejection, with the message naming the recipient kind as for `submit(const message&)`.
+    @throw smtp_error Mail message rejection.
+    @throw *          `mail_from(const string&, string::size_type)`, `rcpt_to(const string&)`, `data(const formatted_message&)`,
+                      `parse_line(const string&)`, `dialog::receive()`.
+    **/
+    std::string submit(const formatted_message& msg);
+
+    /**
+    Submitting a message to the recipients accepted by the server.
+
+    A rejected recipient does not abort the transaction, its status is reported instead and the message is sent to the accepted recipients. If no recipient
+    is accepted, then the transaction is reset without sending the message content. The rejection of the message content is reported as well.
+
+    @param msg        Mail message to send.
+    @return           Statuses of the recipients and of the message content.
+    @throw *          `envelope(const string&, const vector<string>&, string::size_type)`, `declared_size(const message&)`, `data(const message&)`,
+                      `parse_line(const string&)`, `dialog::receive()`.
+    **/
+    submit_report_t submit_partial(const message& msg);
+
+    /**
+    Submitting an already formatted message to the recipients accepted by the server.
+
+    @param msg        Formatted message to send.
+    @return           Statuses of the recipients and of the message content.
+    @throw *          `envelope(const string&, const vector<string>&, string::size_type)`, `data(const formatted_message&)`, `parse_line(const string&)`,
+                      `dialog::receive()`.
+    **/
+    submit_report_t submit_partial(const formatted_message& msg);
+
     /**
     Setting the source hostname.
 
@@ -147,6 +250,11 @@ public:
 
 protected:
 
+    /**
+    Writer of the message data, issuing the `DATA` command and sending the message with the end of message mark.
+    **/
+    using data_writer_t = std::function<void()>;
+
     /**
     SMTP response status.
     **/
@@ -172,13 +280,203 @@ protected:
     **/
     void auth_login(const std::string& username, const std::string& password);
 
+    /**
+    Authenticating with the plain method, sending the credentials as the initial response.
+
+    @param username   Username to authenticate.
+    @param password   Password to authenticate.
+    @throw smtp_error Authentication rejection.
+    @throw *          `auth_initial_response(const string&, const string&)`.
+    **/
+    void auth_plain(const std::string& username, const std::string& password);
+
+    /**
+    Authenticating with the XOAUTH2 method, sending the credentials as the initial response.
+
+    @param username     Username to authenticate.
+    @param access_token OAuth2 access token.
+    @throw smtp_error   Authentication rejection.
+    @throw *            `auth_initial_response(const string&, const string&)`.
+    **/
+    void auth_xoauth2(const std::string& username, const std::string& access_token);
+
+    /**
+    Issuing the `AUTH` command with the initial response as defined by RFC 4954.
+
+    If the server replies with a challenge instead of the completion, then the challenge is answered with the empty line, so the server reports the failure.
+
+    @param mechanism        SASL mechanism name.
+    @param initial_response Initial response not encoded yet.
+    @throw smtp_error       Authentication rejection.
+    @throw *                `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    void auth_initial_response(const std::string& mechanism, const std::string& initial_response);
+
+    /**
+    Checking if the server advertises the given authentication mechanism.
+
+    @param mechanism SASL mechanism name.
+    @return          True if the mechanism is advertised, false if not.
+    **/
+    bool auth_advertised(const std::string& mechanism) const;
+
     /**
     Issuing `EHLO` and/or `HELO` commands.
 
+    The service extensions advertised on `EHLO` are stored, replacing the previous ones.
+
     @throw smtp_error Initial message rejection.
+    @throw *          `hello(const string&)`, `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    virtual void ehlo();
+
+    /**
+    Issuing the given greeting command with the source hostname and reading its reply.
+
+    The service extensions advertised in the reply are stored, replacing the previous ones.
+
+    @param command Greeting command, such as `EHLO`.
+    @return        Parsed last line of the reply.
+    @throw *       `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    std::tuple<int, bool, std::string> hello(const std::string& command);
+
+    /**
+    Storing a service extension line of the `EHLO` reply.
+
+    @param ext_line Extension keyword optionally followed by its parameters.
+    **/
+    void add_extension(const std::string& ext_line);
+
+    /**
+    Issuing the `MAIL FROM` command with the given sender address.
+
+    If the server advertises the `SIZE` extension, then the message size is declared, and a message exceeding the server limit is rejected before the
+    transaction begins.
+
+    @param address    Envelope sender address.
+    @param size       Message size in octets, zero if unknown.
+    @throw smtp_error Message size exceeding the server limit.
+    @throw smtp_error Mail sender rejection.
     @throw *          `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
     **/
-    void ehlo();
+    void mail_from(const std::string& address, std::string::size_type size = 0);
+
+    /**
+    Calculating the message size to declare by the `MAIL FROM` command.
+
+    The size is declared only if it is calculated without encoding the content, so the message is not formatted twice. The `SIZE` parameter is
+    optional, and a message exceeding the server limit is rejected by the `DATA` reply anyway.
+
+    @param msg Message to submit.
+    @return    Formatted message size without the escaped leading dots if the server advertises the `SIZE` extension and the size is calculated
+               without encoding the content, zero if not.
+    @throw *   `message::formatted_size(const message_format_options_t&)`.
+    **/
+    std::string::size_type declared_size(const message& msg) const;
+
+    /**
+    Issuing the `RCPT TO` command for the given address.
+
+    @param address Recipient address.
+    @return        Parsed server reply.
+    @throw *       `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    std::tuple<int, bool, std::string> rcpt_to(const std::string& address);
+
+    /**
+    Issuing the `MAIL FROM` command and the `RCPT TO` command for each recipient.
+
+    If no recipient is accepted, then the transaction is reset.
+
+    @param sender     Envelope sender address.
+    @param recipients Envelope recipient addresses.
+    @param size       Message size in octets, zero if unknown.
+    @return           Status of each recipient in the order of `RCPT TO` commands.
+    @throw *          `mail_from(const string&, string::size_type)`, `rcpt_to(const string&)`, `reset()`.
+    **/
+    std::vector<recipient_status_t> envelope(const std::string& sender, const std::vector<std::string>& recipients, std::string::size_type size = 0);
+
+    /**
+    Issuing the mail transaction which fails on the first rejected recipient.
+
+    @param envelope    Envelope addresses along with the recipient kinds.
+    @param size        Message size in octets, zero if unknown.
+    @param data_writer Writer of the message data.
+    @return            The SMTP server's reply on accepting the message.
+    @throw smtp_error  Mail recipient rejection, with the message naming the recipient kind.
+    @throw smtp_error  Mail message rejection.
+    @throw *           `mail_from(const string&, string::size_type)`, `rcpt_to(const string&)`, `parse_line(const string&)`, `dialog::receive()`,
+                       exception of the data writer.
+    **/
+    std::string transaction(const formatted_message::envelope_t& envelope, std::string::size_type size, const data_writer_t& data_writer);
+
+    /**
+    Issuing the mail transaction which sends the message to the accepted recipients.
+
+    @param envelope    Envelope addresses.
+    @param size        Message size in octets, zero if unknown.
+    @param data_writer Writer of the message data.
+    @return            Statuses of the recipients and of the message content.
+    @throw *           `envelope(const string&, const vector<string>&, string::size_type)`, `parse_line(const string&)`, `dialog::receive()`,
+                       exception of the data writer.
+    **/
+    submit_report_t partial_transaction(const formatted_message::envelope_t& envelope, std::string::size_type size, const data_writer_t& data_writer);
+
+    /**
+    Checking if any recipient is accepted.
+
+    @param recipients Recipient statuses to check.
+    @return           True if at least one recipient is accepted, false if not.
+    **/
+    static bool any_accepted(const std::vector<recipient_status_t>& recipients);
+
+    /**
+    Issuing the `DATA` command, expecting the server to start the message input.
+
+    @throw smtp_error Mail message rejection.
+    @throw *          `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    void start_data();
+
+    /**
+    Issuing the `DATA` command and sending the formatted message with the end of message mark.
+
+    The server reply on the message itself is left to the caller, since it differs between SMTP and LMTP.
+
+    @param msg        Formatted message to send.
+    @throw *          `start_data()`, `dialog::send_raw(const string&)`.
+    **/
+    void data(const formatted_message& msg);
+
+    /**
+    Issuing the `DATA` command and formatting the message straight to the network, with the end of message mark.
+
+    The message is written in chunks of at most `DATA_CHUNK_LEN` characters, so it is never formatted entirely in memory. The leading dots are
+    escaped while writing. If the message fails to format before the first chunk is written, then the transaction is reset; if it fails later,
+    then the connection cannot be used further.
+
+    @param msg        Message to send.
+    @throw *          `start_data()`, `reset()`, `message::format(const format_sink_t&, const message_format_options_t&)`,
+                      `dialog::send_raw(const string&)`.
+    **/
+    void data(const message& msg);
+
+    /**
+    Issuing the `RSET` command to abort the current mail transaction.
+
+    @throw smtp_error Mail transaction reset failure.
+    @throw *          `parse_line(const string&)`, `dialog::send(const string&)`, `dialog::receive()`.
+    **/
+    void reset();
+
+    /**
+    Getting the error message for a rejected envelope recipient.
+
+    @param kind Kind of the rejected recipient.
+    @return     Error message naming the recipient kind.
+    **/
+    static std::string recipient_rejection(formatted_message::recipient_kind_t kind);
 
     /**
     Switching to TLS layer.
@@ -242,11 +540,21 @@ protected:
     **/
     static const uint16_t SERVICE_READY_STATUS = 220;
 
+    /**
+    Maximum length of a chunk written when the message is formatted straight to the network.
+    **/
+    static const std::string::size_type DATA_CHUNK_LEN = 16384;
+
     /**
     Name of the host which client is connecting from.
     **/
     std::string src_host_;
 
+    /**
+    Service extensions advertised by the server, indexed by the uppercase keyword and containing the extension parameters.
+    **/
+    std::map<std::string, std::string> extensions_;
+
     /**
     Dialog to use for send/receive operations.
     **/
@@ -279,8 +587,12 @@ public:
       mechanism is allowed.
     - LOGIN: The username and password are sent in Base64 format.
     - START_TLS: For the TCP connection, a TLS negotiation is asked before sending the login parameters.
+    - PLAIN: The username and password are sent as the initial response of the `AUTH PLAIN` command, as for `smtp::auth_method_t::PLAIN`.
+    - XOAUTH2: The username and OAuth2 access token (given as the password) are sent as the initial response of the `AUTH XOAUTH2` command.
+    - START_TLS_PLAIN: The plain mechanism after the TLS negotiation.
+    - START_TLS_XOAUTH2: The XOAUTH2 mechanism after the TLS negotiation.
     **/
-    enum class auth_method_t {NONE, LOGIN, START_TLS};
+    enum class auth_method_t {NONE, LOGIN, START_TLS, PLAIN, XOAUTH2, START_TLS_PLAIN, START_TLS_XOAUTH2};
 
     /**
     Making a connection to the server.
@@ -316,7 +628,7 @@ public:
     @param password Password to authenticate.
     @param method   Authentication method to use.
     @return         The server greeting message.
-    @throw *        `start_tls()`, `switch_to_ssl()`, `ehlo()`, `auth_login(const string&, const string&)`, `connect()`.
+    @throw *        `smtp::authenticate(const string&, const string&, smtp::auth_method_t)`.
     **/
     std::string authenticate(const std::string& username, const std::string& password, auth_method_t method);
 
@@ -329,6 +641,115 @@ public:
 };
 
 
+/**
+LMTP client implementation.
+
+The local mail transfer protocol as defined by RFC 2033 is used to deliver messages into local mailboxes. It reuses the SMTP commands, except that the `LHLO`
+greeting replaces the `EHLO` one. Once the message data is sent, the server replies with a status for each accepted recipient instead of a single one, so
+a message is delivered to many mailboxes within a single transaction while the delivery to each of them is confirmed separately.
+
+The connection options are the same as for `smtp`, so the start tls should be turned off over `start_tls(false)` if the server does not offer it. The SMTP
+client is inherited as protected, since its submission reads a single reply on the message data, which would leave the LMTP connection out of sync.
+**/
+class MAILIO_EXPORT lmtp : protected smtp
+{
+public:
+
+    using smtp::auth_method_t;
+
+    using smtp::recipient_status_t;
+
+    using smtp::authenticate;
+
+    using smtp::source_hostname;
+
+    using smtp::start_tls;
+
+    using smtp::ssl_options;
+
+    /**
+    Making a connection to the server.
+
+    Parent constructor is called to do all the work.
+
+    @param hostname Hostname of the server.
+    @param port     Port of the server.
+    @param timeout  Network timeout after which I/O operations fail. If zero, then no timeout is set i.e. I/O operations are synchronous.
+    @throw *        `smtp::smtp(const string&, unsigned, milliseconds)`.
+    **/
+    lmtp(const std::string& hostname, unsigned port, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    /**
+    Sending the quit command and closing the connection.
+
+    Parent destructor is called to do all the work.
+    **/
+    ~lmtp() = default;
+
+    lmtp(const lmtp&) = delete;
+
+    lmtp(lmtp&&) = delete;
+
+    void operator=(const lmtp&) = delete;
+
+    void operator=(lmtp&&) = delete;
+
+    /**
+    Submitting a message to all its recipients within a single transaction.
+
+    A rejected recipient does not abort the transaction, its status is reported instead. If no recipient is accepted, then the transaction is reset
+    without sending the message.
+
+    @param msg Mail message to deliver.
+    @return    Status of each recipient in the order of `RCPT TO` commands. For an accepted recipient it is the delivery status of the message, for a
+               rejected one it is the reply on its `RCPT TO` command.
+    @throw *   `envelope(const string&, const vector<string>&, string::size_type)`, `declared_size(const message&)`, `data(const message&)`,
+               `delivery_statuses(vector&)`.
+    **/
+    std::vector<recipient_status_t> submit(const message& msg);
+
+    /**
+    Submitting an already formatted message to all its recipients within a single transaction.
+
+    @param msg Formatted message to deliver.
+    @return    Status of each recipient in the order of `RCPT TO` commands.
+    @throw *   `envelope(const string&, const vector<string>&, string::size_type)`, `data(const formatted_message&)`, `delivery_statuses(vector&)`.
+    **/
+    std::vector<recipient_status_t> submit(const formatted_message& msg);
+
+protected:
+
+    /**
+    Issuing the mail transaction and reading the delivery status of each accepted recipient.
+
+    @param envelope    Envelope addresses.
+    @param size        Message size in octets, zero if unknown.
+    @param data_writer Writer of the message data.
+    @return            Status of each recipient in the order of `RCPT TO` commands.
+    @throw *           `envelope(const string&, const vector<string>&, string::size_type)`, `delivery_statuses(vector&)`, exception of the data writer.
+    **/
+    std::vector<recipient_status_t> deliver(const formatted_message::envelope_t& envelope, std::string::size_type size, const data_writer_t& data_writer);
+
+    /**
+    Reading the delivery status of each accepted recipient, replied after the message data.
+
+    @param statuses Recipient statuses, the accepted ones replaced by their delivery statuses.
+    @throw *        `parse_line(const string&)`, `dialog::receive()`.
+    **/
+    void delivery_statuses(std::vector<recipient_status_t>& statuses);
+
+    /**
+    Issuing the `LHLO` command.
+
+    The service extensions advertised on `LHLO` are stored, replacing the previous ones.
+
+    @throw smtp_error Initial message rejection.
+    @throw *          `hello(const string&)`.
+    **/
+    void ehlo() override;
+};
+
+
 /**
 Error thrown by SMTP client.
 **/
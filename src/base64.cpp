@@ -116,6 +116,14 @@ vector<string> base64::encode(const string& text) const
 }
 
 
+string base64::encode_line(const string& text)
+{
+    base64 b64(static_cast<string::size_type>(line_len_policy_t::NONE), static_cast<string::size_type>(line_len_policy_t::NONE));
+    vector<string> enc_text = b64.encode(text);
+    return enc_text.empty() ? "" : enc_text[0];
+}
+
+
 string base64::decode(const vector<string>& text) const
 {
     string dec_text;
@@ -70,6 +70,8 @@ void dialog::connect()
         }
         else
             connect_async();
+        // The data is already written in whole commands and bounded chunks, so the last small chunk should not wait for the delayed acknowledgment.
+        socket_->set_option(tcp::no_delay(true));
     }
     catch (const system_error& exc)
     {
@@ -79,11 +81,17 @@ void dialog::connect()
 
 
 void dialog::send(const string& line)
+{
+    send_raw(line + "\r\n");
+}
+
+
+void dialog::send_raw(const string& data)
 {
     if (timeout_.count() == 0)
-        send_sync(*socket_, line);
+        send_sync(*socket_, data);
     else
-        send_async(*socket_, line);
+        send_async(*socket_, data);
 }
 
 
@@ -97,13 +105,56 @@ string dialog::receive(bool raw)
 }
 
 
+/*
+The socket is checked for readability only, so no data is consumed if the time expires. The io context is restarted in case that it has run out of work
+before.
+*/
+bool dialog::wait_read(milliseconds wait)
+{
+    // A line may already be buffered by the previous read.
+    if (strmbuf_->size() > 0)
+        return true;
+
+    if (ios_.stopped())
+        ios_.restart();
+    steady_timer wait_timer(ios_);
+    wait_timer.expires_after(wait);
+    bool has_waited{false}, timer_done{false}, is_ready{false};
+    error_code errc;
+    socket_->async_wait(tcp::socket::wait_read,
+        [&has_waited, &is_ready, &errc](const error_code& error)
+        {
+            if (!error)
+                is_ready = true;
+            else if (error != boost::asio::error::operation_aborted)
+                errc = error;
+            has_waited = true;
+        });
+    wait_timer.async_wait(
+        [this, &timer_done](const error_code& error)
+        {
+            if (!error)
+                socket_->cancel();
+            timer_done = true;
+        });
+    while (!has_waited)
+        ios_.run_one();
+    wait_timer.cancel();
+    while (!timer_done)
+        ios_.run_one();
+
+    if (errc)
+        throw dialog_error("Network waiting failed.", errc.message());
+    return is_ready;
+}
+
+
 template<typename Socket>
-void dialog::send_sync(Socket& socket, const string& line)
+void dialog::send_sync(Socket& socket, const string& data)
 {
     try
     {
-        string l = line + "\r\n";
-        write(socket, buffer(l, l.size()));
+        write(socket, buffer(data, data.size()));
     }
     catch (const system_error& exc)
     {
@@ -152,13 +203,12 @@ void dialog::connect_async()
 
 
 template<typename Socket>
-void dialog::send_async(Socket& socket, string line)
+void dialog::send_async(Socket& socket, const string& data)
 {
     check_timeout();
-    string l = line + "\r\n";
     bool has_written{false}, send_error{false};
     error_code errc;
-    async_write(socket, buffer(l, l.size()),
+    async_write(socket, buffer(data, data.size()),
         [&has_written, &send_error, &errc](const error_code& error, size_t)
         {
             if (!error)
@@ -252,17 +302,23 @@ dialog_ssl::dialog_ssl(const dialog& other, const ssl_options_t& options) : dial
 
 
 void dialog_ssl::send(const string& line)
+{
+    send_raw(line + "\r\n");
+}
+
+
+void dialog_ssl::send_raw(const string& data)
 {
     if (!ssl_)
     {
-        dialog::send(line);
+        dialog::send_raw(data);
         return;
     }
 
     if (timeout_.count() == 0)
-        send_sync(*ssl_socket_, line);
+        send_sync(*ssl_socket_, data);
     else
-        send_async(*ssl_socket_, line);
+        send_async(*ssl_socket_, data);
 }
 
 
@@ -285,6 +341,14 @@ string dialog_ssl::receive(bool raw)
 }
 
 
+bool dialog_ssl::wait_read(milliseconds wait)
+{
+    if (ssl_ && SSL_pending(ssl_socket_->native_handle()) > 0)
+        return true;
+    return dialog::wait_read(wait);
+}
+
+
 shared_ptr<dialog_ssl> dialog_ssl::to_ssl(const shared_ptr<dialog> dlg, const dialog_ssl::ssl_options_t& options)
 {
     return make_shared<dialog_ssl>(*dlg, options);
@@ -0,0 +1,315 @@
+/*
+
+dkim.cpp
+--------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <mailio/codec.hpp>
+#include <mailio/base64.hpp>
+#include <mailio/message.hpp>
+#include <mailio/dkim.hpp>
+
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::move;
+using boost::iequals;
+using boost::to_lower_copy;
+using boost::trim_copy;
+
+
+namespace mailio
+{
+
+
+/*
+According to the RFC 6376 section 3.4.4, the relaxed body canonicalization reduces whitespace sequences to a single space, removes the whitespaces at
+the line ends and ignores the empty lines at the end of the body. The empty lines are counted, and hashed only when a non-empty line follows them.
+*/
+class dkim_signer::canonicalizer
+{
+public:
+
+    explicit canonicalizer(bool dot_escape) : dot_escape_(dot_escape), header_done_(false), empty_lines_(0), hash_ctx_(EVP_MD_CTX_new(), EVP_MD_CTX_free)
+    {
+        if (hash_ctx_ == nullptr || EVP_DigestInit_ex(hash_ctx_.get(), EVP_sha256(), nullptr) != 1)
+            throw dkim_error("Body hashing failure.", "");
+    }
+
+    void update(const string& chunk)
+    {
+        if (header_done_)
+        {
+            update_body(chunk, 0);
+            return;
+        }
+
+        string::size_type search_pos = header_.length() < HEADER_END.length() ? 0 : header_.length() - HEADER_END.length() + 1;
+        header_ += chunk;
+        string::size_type header_end = header_.find(HEADER_END, search_pos);
+        if (header_end == string::npos)
+            return;
+
+        header_done_ = true;
+        update_body(header_, header_end + HEADER_END.length());
+        header_.resize(header_end + codec::END_OF_LINE.length());
+    }
+
+    string body_hash()
+    {
+        if (!line_.empty())
+        {
+            hash_line(line_);
+            line_.clear();
+        }
+
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len = 0;
+        if (EVP_DigestFinal_ex(hash_ctx_.get(), digest, &digest_len) != 1)
+            throw dkim_error("Body hashing failure.", "");
+        return base64::encode_line(string(reinterpret_cast<const char*>(digest), digest_len));
+    }
+
+    const string& header() const
+    {
+        return header_;
+    }
+
+private:
+
+    void update_body(const string& chunk, string::size_type pos)
+    {
+        string::size_type line_end = chunk.find(codec::LF_CHAR, pos);
+        while (line_end != string::npos)
+        {
+            line_.append(chunk, pos, line_end - pos);
+            if (!line_.empty() && line_.back() == codec::CR_CHAR)
+                line_.pop_back();
+            hash_line(line_);
+            line_.clear();
+            pos = line_end + 1;
+            line_end = chunk.find(codec::LF_CHAR, pos);
+        }
+        line_.append(chunk, pos, string::npos);
+    }
+
+    void hash_line(const string& line)
+    {
+        string::size_type begin = (dot_escape_ && !line.empty() && line[0] == codec::DOT_CHAR) ? 1 : 0;
+        string canonical;
+        bool wsp = false;
+        for (string::size_type i = begin; i < line.length(); i++)
+        {
+            if (line[i] == codec::SPACE_CHAR || line[i] == codec::TAB_CHAR)
+                wsp = true;
+            else
+            {
+                if (wsp)
+                    canonical += codec::SPACE_CHAR;
+                wsp = false;
+                canonical += line[i];
+            }
+        }
+
+        if (canonical.empty())
+        {
+            empty_lines_++;
+            return;
+        }
+        for (; empty_lines_ > 0; empty_lines_--)
+            hash(codec::END_OF_LINE);
+        hash(canonical + codec::END_OF_LINE);
+    }
+
+    void hash(const string& data)
+    {
+        if (EVP_DigestUpdate(hash_ctx_.get(), data.data(), data.length()) != 1)
+            throw dkim_error("Body hashing failure.", "");
+    }
+
+    static const string HEADER_END;
+
+    const bool dot_escape_;
+
+    bool header_done_;
+
+    string header_;
+
+    string line_;
+
+    unsigned long empty_lines_;
+
+    unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> hash_ctx_;
+};
+
+
+const string dkim_signer::canonicalizer::HEADER_END = codec::END_OF_LINE + codec::END_OF_LINE;
+
+
+const vector<string> dkim_signer::DEFAULT_SIGNED_HEADERS{"From", "Sender", "Reply-To", "To", "Cc", "Subject", "Date", "Message-ID", "In-Reply-To",
+    "References", "MIME-Version", "Content-Type", "Content-Transfer-Encoding"};
+
+
+dkim_signer::dkim_signer(const string& domain, const string& selector, const string& private_key, algorithm_t algorithm,
+    const vector<string>& signed_headers) :
+    domain_(domain), selector_(selector), algorithm_(algorithm), signed_headers_(signed_headers)
+{
+    if (domain_.empty() || selector_.empty())
+        throw dkim_error("Empty domain or selector.", "");
+
+    unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new_mem_buf(private_key.data(), static_cast<int>(private_key.length())), BIO_free);
+    if (bio == nullptr)
+        throw dkim_error("Reading private key failure.", "");
+    private_key_ = shared_ptr<EVP_PKEY>(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+    if (private_key_ == nullptr)
+        throw dkim_error("Reading private key failure.", "");
+
+    int key_type = (algorithm_ == algorithm_t::RSA_SHA256) ? EVP_PKEY_RSA : EVP_PKEY_ED25519;
+    if (EVP_PKEY_id(private_key_.get()) != key_type)
+        throw dkim_error("Private key not matching the algorithm.", "");
+}
+
+
+/*
+According to the RFC 6376 section 5.4.2, multiple instances of a signed header are signed from the bottom up. The `DKIM-Signature` header itself is
+hashed last, with the empty `b=` tag and without the trailing end of line.
+*/
+formatted_message dkim_signer::sign(const message& msg) const
+{
+    string msg_str;
+    canonicalizer canon(true);
+    msg.format([&msg_str, &canon](const string& chunk) { msg_str += chunk; canon.update(chunk); }, message_format_options_t{true, false});
+    string body_hash = canon.body_hash();
+
+    // Split the header to the fields, keeping the folded lines together.
+    vector<string> fields;
+    const string& header = canon.header();
+    string::size_type line_begin = 0;
+    string::size_type line_end = header.find(codec::END_OF_LINE);
+    while (line_end != string::npos)
+    {
+        string line = header.substr(line_begin, line_end - line_begin);
+        if (!fields.empty() && !line.empty() && (line[0] == codec::SPACE_CHAR || line[0] == codec::TAB_CHAR))
+            fields.back() += codec::END_OF_LINE + line;
+        else
+            fields.push_back(line);
+        line_begin = line_end + codec::END_OF_LINE.length();
+        line_end = header.find(codec::END_OF_LINE, line_begin);
+    }
+
+    string header_names;
+    string hashed_data;
+    for (const auto& name : signed_headers_)
+        for (auto field = fields.rbegin(); field != fields.rend(); field++)
+        {
+            string::size_type colon_pos = field->find(codec::COLON_CHAR);
+            if (colon_pos == string::npos || !iequals(trim_copy(field->substr(0, colon_pos)), name))
+                continue;
+            header_names += (header_names.empty() ? "" : ":") + to_lower_copy(name);
+            hashed_data += canonicalize_header(*field) + codec::END_OF_LINE;
+        }
+
+    const string algorithm = (algorithm_ == algorithm_t::RSA_SHA256) ? "rsa-sha256" : "ed25519-sha256";
+    string dkim_header = "DKIM-Signature: v=1; a=" + algorithm + "; c=relaxed/relaxed; d=" + domain_ + "; s=" + selector_ + ";" + codec::END_OF_LINE +
+        "  h=" + header_names + ";" + codec::END_OF_LINE + "  bh=" + body_hash + ";" + codec::END_OF_LINE + "  b=";
+    hashed_data += canonicalize_header(dkim_header);
+    string signature = sign_data(hashed_data);
+
+    const string::size_type FOLD_LEN = 72;
+    for (string::size_type pos = 0; pos < signature.length(); pos += FOLD_LEN)
+        dkim_header += (pos == 0 ? "" : codec::END_OF_LINE + "  ") + signature.substr(pos, FOLD_LEN);
+    dkim_header += codec::END_OF_LINE;
+
+    return formatted_message(dkim_header + msg_str, formatted_message::make_envelope(msg));
+}
+
+
+/*
+According to the RFC 6376 section 3.4.2, the relaxed header canonicalization converts the header name to lowercase, unfolds the value, reduces the
+whitespace sequences to a single space and removes the whitespaces around the colon and at the end of the value.
+*/
+string dkim_signer::canonicalize_header(const string& field)
+{
+    string::size_type colon_pos = field.find(codec::COLON_CHAR);
+    string name = to_lower_copy(trim_copy(field.substr(0, colon_pos)));
+    string value;
+    bool wsp = false;
+    for (string::size_type i = colon_pos + 1; i < field.length(); i++)
+    {
+        char ch = field[i];
+        if (ch == codec::CR_CHAR || ch == codec::LF_CHAR)
+            continue;
+        if (ch == codec::SPACE_CHAR || ch == codec::TAB_CHAR)
+            wsp = true;
+        else
+        {
+            if (wsp && !value.empty())
+                value += codec::SPACE_CHAR;
+            wsp = false;
+            value += ch;
+        }
+    }
+    return name + codec::COLON_CHAR + value;
+}
+
+
+/*
+According to the RFC 8463 section 3, the Ed25519 signature is calculated over the SHA256 hash of the data, while the RSA signature is calculated over the
+data itself, hashing it as part of the signing.
+*/
+string dkim_signer::sign_data(const string& data) const
+{
+    unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (ctx == nullptr)
+        throw dkim_error("Signing failure.", "");
+
+    string input = data;
+    const EVP_MD* md = EVP_sha256();
+    if (algorithm_ == algorithm_t::ED25519_SHA256)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len = 0;
+        if (EVP_Digest(data.data(), data.length(), digest, &digest_len, EVP_sha256(), nullptr) != 1)
+            throw dkim_error("Signing failure.", "");
+        input = string(reinterpret_cast<const char*>(digest), digest_len);
+        md = nullptr;
+    }
+
+    if (EVP_DigestSignInit(ctx.get(), nullptr, md, nullptr, private_key_.get()) != 1)
+        throw dkim_error("Signing failure.", "");
+    size_t sig_len = 0;
+    if (EVP_DigestSign(ctx.get(), nullptr, &sig_len, reinterpret_cast<const unsigned char*>(input.data()), input.length()) != 1)
+        throw dkim_error("Signing failure.", "");
+    vector<unsigned char> sig(sig_len);
+    if (EVP_DigestSign(ctx.get(), sig.data(), &sig_len, reinterpret_cast<const unsigned char*>(input.data()), input.length()) != 1)
+        throw dkim_error("Signing failure.", "");
+    return base64::encode_line(string(reinterpret_cast<const char*>(sig.data()), sig_len));
+}
+
+
+string dkim_error::details() const
+{
+    return details_;
+}
+
+
+} // namespace mailio
@@ -12,22 +12,34 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 
 
 #include <algorithm>
+#include <deque>
+#include <exception>
+#include <future>
 #include <locale>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <tuple>
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/algorithm/string/compare.hpp>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/regex.hpp>
+#include <mailio/base64.hpp>
 #include <mailio/imap.hpp>
 
 
+using std::any_of;
+using std::current_exception;
+using std::deque;
+using std::exception_ptr;
 using std::find_if;
+using std::future;
+using std::future_status;
 using std::invalid_argument;
 using std::logic_error;
 using std::list;
@@ -35,24 +47,34 @@ using std::make_optional;
 using std::make_shared;
 using std::make_tuple;
 using std::map;
+using std::min;
 using std::move;
 using std::out_of_range;
+using std::packaged_task;
 using std::pair;
-using std::shared_ptr;
+using std::rethrow_exception;
 using std::stoul;
+using std::stoull;
 using std::string;
 using std::stringstream;
+using std::string_view;
 using std::to_string;
 using std::tuple;
 using std::vector;
 using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using boost::asio::post;
+using boost::asio::thread_pool;
 using boost::system::system_error;
 using boost::iequals;
+using boost::istarts_with;
 using boost::regex;
 using boost::regex_match;
 using boost::smatch;
 using boost::split;
 using boost::trim;
+using boost::algorithm::to_lower_copy;
+using boost::algorithm::trim_copy;
 using boost::algorithm::trim_copy_if;
 using boost::algorithm::trim_if;
 using boost::algorithm::is_any_of;
@@ -63,6 +85,7 @@ namespace mailio
 
 const string imap::UNTAGGED_RESPONSE{"*"};
 const string imap::CONTINUE_RESPONSE{"+"};
+const string imap::INBOX_MAILBOX{"INBOX"};
 const string imap::RANGE_SEPARATOR{":"};
 const string imap::RANGE_ALL{"*"};
 const string imap::LIST_SEPARATOR{","};
@@ -78,7 +101,301 @@ string imap::messages_range_to_string(imap::messages_range_t id_pair)
 
 string imap::messages_range_list_to_string(list<messages_range_t> ranges)
 {
-    return boost::join(ranges | boost::adaptors::transformed(static_cast<string(*)(messages_range_t)>(messages_range_to_string)), LIST_SEPARATOR);
+    return messages_set_t(ranges).to_string();
+}
+
+
+imap::messages_set_t::messages_set_t(std::initializer_list<messages_range_t> ranges)
+{
+    for (const auto& range : ranges)
+        insert(range.first, range.second.value_or(LAST_ID));
+}
+
+
+imap::messages_set_t::messages_set_t(const list<messages_range_t>& ranges)
+{
+    for (const auto& range : ranges)
+        insert(range.first, range.second.value_or(LAST_ID));
+}
+
+
+void imap::messages_set_t::insert(unsigned long id)
+{
+    insert(id, id);
+}
+
+
+/*
+The interval before the inserted one is merged if it overlaps or touches it, and so are the following intervals up to the last ID of the inserted one.
+*/
+void imap::messages_set_t::insert(unsigned long first, unsigned long last)
+{
+    if (first > last)
+        std::swap(first, last);
+    auto next = intervals_.upper_bound(first);
+    if (next != intervals_.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->second >= first || prev->second + 1 == first)
+        {
+            first = prev->first;
+            last = std::max(last, prev->second);
+            intervals_.erase(prev);
+        }
+    }
+    while (next != intervals_.end() && (next->first <= last || next->first - 1 == last))
+    {
+        last = std::max(last, next->second);
+        next = intervals_.erase(next);
+    }
+    intervals_.emplace_hint(next, first, last);
+}
+
+
+bool imap::messages_set_t::contains(unsigned long id) const
+{
+    auto next = intervals_.upper_bound(id);
+    return next != intervals_.begin() && std::prev(next)->second >= id;
+}
+
+
+bool imap::messages_set_t::empty() const
+{
+    return intervals_.empty();
+}
+
+
+bool imap::messages_set_t::closed() const
+{
+    return intervals_.empty() || intervals_.rbegin()->second != LAST_ID;
+}
+
+
+unsigned long imap::messages_set_t::size() const
+{
+    if (!closed())
+        throw imap_error("Open messages set.", "Set=`" + to_string() + "`.");
+    unsigned long count = 0;
+    for (const auto& interval : intervals_)
+        count += interval.second - interval.first + 1;
+    return count;
+}
+
+
+auto imap::messages_set_t::intervals() const -> const intervals_t&
+{
+    return intervals_;
+}
+
+
+auto imap::messages_set_t::begin() const -> const_iterator
+{
+    if (!closed())
+        throw imap_error("Open messages set.", "Set=`" + to_string() + "`.");
+    return const_iterator(intervals_.begin(), intervals_.end());
+}
+
+
+auto imap::messages_set_t::end() const -> const_iterator
+{
+    return const_iterator(intervals_.end(), intervals_.end());
+}
+
+
+string imap::messages_set_t::to_string() const
+{
+    vector<string> sequence_sets = to_strings(string::npos);
+    return sequence_sets.empty() ? "" : sequence_sets.front();
+}
+
+
+vector<string> imap::messages_set_t::to_strings(string::size_type max_length) const
+{
+    auto id_to_string = [](unsigned long id)
+    {
+        return id == LAST_ID ? RANGE_ALL : std::to_string(id);
+    };
+
+    vector<string> sequence_sets;
+    string sequence_set;
+    for (const auto& interval : intervals_)
+    {
+        string range = id_to_string(interval.first);
+        if (interval.second != interval.first)
+            range += RANGE_SEPARATOR + id_to_string(interval.second);
+        if (!sequence_set.empty() && sequence_set.length() + LIST_SEPARATOR.length() + range.length() > max_length)
+        {
+            sequence_sets.push_back(move(sequence_set));
+            sequence_set.clear();
+        }
+        if (!sequence_set.empty())
+            sequence_set += LIST_SEPARATOR;
+        sequence_set += range;
+    }
+    if (!sequence_set.empty())
+        sequence_sets.push_back(move(sequence_set));
+    return sequence_sets;
+}
+
+
+auto imap::messages_set_t::operator|=(const messages_set_t& other) -> messages_set_t&
+{
+    for (const auto& interval : other.intervals_)
+        insert(interval.first, interval.second);
+    return *this;
+}
+
+
+/*
+Both sets are sorted, so they are walked together, and each overlap of two intervals is added to the end of the result. The interval ending first is
+passed, since it cannot overlap the following intervals of the other set.
+*/
+auto imap::messages_set_t::operator&=(const messages_set_t& other) -> messages_set_t&
+{
+    intervals_t common;
+    auto interval = intervals_.begin();
+    auto other_interval = other.intervals_.begin();
+    while (interval != intervals_.end() && other_interval != other.intervals_.end())
+    {
+        const unsigned long first = std::max(interval->first, other_interval->first);
+        const unsigned long last = std::min(interval->second, other_interval->second);
+        if (first <= last)
+            common.emplace_hint(common.end(), first, last);
+        if (interval->second < other_interval->second)
+            ++interval;
+        else
+            ++other_interval;
+    }
+    intervals_ = move(common);
+    return *this;
+}
+
+
+/*
+Each interval is cut by the subtracted intervals overlapping it, and the remaining parts are added to the end of the result. The subtracted interval
+reaching beyond the current one may cut the following one as well, so it is not passed yet.
+*/
+auto imap::messages_set_t::operator-=(const messages_set_t& other) -> messages_set_t&
+{
+    intervals_t remaining;
+    auto other_interval = other.intervals_.begin();
+    for (const auto& interval : intervals_)
+    {
+        unsigned long first = interval.first;
+        bool is_exhausted = false;
+        while (other_interval != other.intervals_.end() && other_interval->second < first)
+            ++other_interval;
+        for (auto cut = other_interval; cut != other.intervals_.end() && cut->first <= interval.second; ++cut)
+        {
+            if (cut->first > first)
+                remaining.emplace_hint(remaining.end(), first, cut->first - 1);
+            if (cut->second >= interval.second)
+            {
+                is_exhausted = true;
+                break;
+            }
+            first = cut->second + 1;
+        }
+        if (!is_exhausted)
+            remaining.emplace_hint(remaining.end(), first, interval.second);
+    }
+    intervals_ = move(remaining);
+    return *this;
+}
+
+
+auto imap::messages_set_t::operator|(const messages_set_t& other) const -> messages_set_t
+{
+    messages_set_t ids(*this);
+    ids |= other;
+    return ids;
+}
+
+
+auto imap::messages_set_t::operator&(const messages_set_t& other) const -> messages_set_t
+{
+    messages_set_t ids(*this);
+    ids &= other;
+    return ids;
+}
+
+
+auto imap::messages_set_t::operator-(const messages_set_t& other) const -> messages_set_t
+{
+    messages_set_t ids(*this);
+    ids -= other;
+    return ids;
+}
+
+
+bool imap::messages_set_t::operator==(const messages_set_t& other) const
+{
+    return intervals_ == other.intervals_;
+}
+
+
+bool imap::messages_set_t::operator!=(const messages_set_t& other) const
+{
+    return intervals_ != other.intervals_;
+}
+
+
+auto imap::messages_set_t::from_string(string_view sequence_set) -> messages_set_t
+{
+    auto to_id = [&sequence_set](string_view id)
+    {
+        if (id == RANGE_ALL)
+            return LAST_ID;
+        // The `stoul()` accepts the leading whitespaces and sign, and the trailing characters.
+        if (id.empty() || id.find_first_not_of("0123456789") != string_view::npos)
+            throw imap_error("Parsing failure.", "Sequence set=`" + string(sequence_set) + "`.");
+        try
+        {
+            return stoul(string(id));
+        }
+        catch (const logic_error&)
+        {
+            throw imap_error("Parsing failure.", "Sequence set=`" + string(sequence_set) + "`.");
+        }
+    };
+
+    messages_set_t ids;
+    if (sequence_set.empty())
+        return ids;
+
+    // Each list separator is followed by a range, so the empty range between or after the separators is parsed as a malformed ID.
+    string_view ranges = sequence_set;
+    string_view::size_type list_pos = 0;
+    do
+    {
+        list_pos = ranges.find(LIST_SEPARATOR);
+        string_view range = ranges.substr(0, list_pos);
+        string_view::size_type range_pos = range.find(RANGE_SEPARATOR);
+        if (range_pos == string_view::npos)
+            ids.insert(to_id(range));
+        else
+            ids.insert(to_id(range.substr(0, range_pos)), to_id(range.substr(range_pos + 1)));
+        ranges = list_pos == string_view::npos ? string_view() : ranges.substr(list_pos + 1);
+    }
+    while (list_pos != string_view::npos);
+    return ids;
+}
+
+
+vector<string> imap::store_commands(const messages_set_t& messages_range, store_op_t op, const vector<string>& flags, bool silent, bool is_uid)
+{
+    if (messages_range.empty())
+        throw imap_error("Empty messages range.", "");
+
+    string item = op == store_op_t::ADD ? "+FLAGS" : (op == store_op_t::REMOVE ? "-FLAGS" : "FLAGS");
+    if (silent)
+        item += ".SILENT";
+    const string flags_list = "(" + boost::join(flags, TOKEN_SEPARATOR_STR) + ")";
+
+    vector<string> commands;
+    for (const auto& sequence_set : messages_range.to_strings(SEQUENCE_SET_MAX_LENGTH))
+        commands.push_back(string(is_uid ? "UID " : "") + "STORE " + sequence_set + TOKEN_SEPARATOR_STR + item + TOKEN_SEPARATOR_STR + flags_list);
+    return commands;
 }
 
 
@@ -101,13 +418,13 @@ imap::search_condition_t::search_condition_t(imap::search_condition_t::key_type
 
             case SID_LIST:
             {
-                imap_string = messages_range_list_to_string(std::get<list<messages_range_t>>(value));
+                imap_string = std::get<messages_set_t>(value).to_string();
                 break;
             }
 
             case UID_LIST:
             {
-                imap_string = "UID " + messages_range_list_to_string(std::get<list<messages_range_t>>(value));
+                imap_string = "UID " + std::get<messages_set_t>(value).to_string();
                 break;
             }
 
@@ -196,8 +513,10 @@ string imap::tag_result_response_t::to_string() const
 
 
 imap::imap(const string& hostname, unsigned port, milliseconds timeout) :
-    dlg_(make_shared<dialog>(hostname, port, timeout)), is_start_tls_(true), tag_(0), optional_part_state_(false), atom_state_(atom_state_t::NONE),
-    parenthesis_list_counter_(0), literal_state_(string_literal_state_t::NONE), eols_no_(2)
+    dlg_(make_shared<dialog>(hostname, port, timeout)), is_start_tls_(true), parser_threads_(0), tag_(0), idle_stopped_(false), tokens_no_(0),
+    optional_part_(&token_arena_), mandatory_part_(&token_arena_), optional_part_state_(false),
+    atom_state_(atom_state_t::NONE),
+    parenthesis_list_counter_(0), literal_state_(string_literal_state_t::NONE), literal_bytes_read_(0), eols_no_(2)
 {
     ssl_options_ =
         {
@@ -231,6 +550,18 @@ string imap::authenticate(const string& username, const string& password, auth_m
 
     if (method == auth_method_t::LOGIN)
         auth_login(username, password);
+    else if (method == auth_method_t::PLAIN)
+    {
+        if (has_capability("AUTH=PLAIN"))
+            auth_sasl("PLAIN", string(1, codec::NIL_CHAR) + username + string(1, codec::NIL_CHAR) + password);
+        else
+            auth_login(username, password);
+    }
+    else if (method == auth_method_t::XOAUTH2)
+    {
+        const string SOH(1, '\x01');
+        auth_sasl("XOAUTH2", "user=" + username + SOH + "auth=Bearer " + password + SOH + SOH);
+    }
     return greeting;
 }
 
@@ -245,12 +576,62 @@ auto imap::select(const list<string>& folder_name, bool /*read_only*/) -> mailbo
 
 auto imap::select(const string& mailbox, bool read_only) -> mailbox_stat_t
 {
-    string cmd;
-    if (read_only)
-        cmd = format("EXAMINE " + to_astring(mailbox));
-    else
-        cmd = format("SELECT " + to_astring(mailbox));
-    dlg_->send(cmd);
+    mailbox_changes_t changes;
+    return select_responses((read_only ? "EXAMINE " : "SELECT ") + to_astring(mailbox), changes);
+}
+
+
+/*
+According to the RFC 7162 section 3.2.5, the known state of the mailbox is given as the select parameter. The changed messages are reported by the fetch
+responses and the removed ones by the vanished response, before the select command completes.
+*/
+auto imap::select(const string& mailbox, unsigned long uid_validity, unsigned long long modseq, const messages_set_t& known_uids,
+    mailbox_changes_t& changes, bool read_only) -> mailbox_stat_t
+{
+    string cmd = (read_only ? "EXAMINE " : "SELECT ") + to_astring(mailbox) + " (QRESYNC (" + to_string(uid_validity) + TOKEN_SEPARATOR_STR +
+        to_string(modseq);
+    if (!known_uids.empty())
+        cmd += TOKEN_SEPARATOR_STR + known_uids.to_string();
+    cmd += "))";
+    return select_responses(cmd, changes);
+}
+
+
+vector<string> imap::enable(const vector<string>& extensions)
+{
+    dlg_->send(format("ENABLE " + boost::join(extensions, TOKEN_SEPARATOR_STR)));
+    vector<string> enabled;
+
+    bool has_more = true;
+    while (has_more)
+    {
+        reset_grammar_parser();
+        string line = dlg_->receive();
+        tag_result_response_t parsed_line = parse_tag_result(line);
+        if (parsed_line.tag == UNTAGGED_RESPONSE)
+        {
+            parse_grammar(parsed_line.response);
+            if (!mandatory_part_.empty() && iequals(mandatory_part_.front()->atom, "ENABLED"))
+                for (auto token = std::next(mandatory_part_.begin()); token != mandatory_part_.end(); token++)
+                    enabled.emplace_back((*token)->atom);
+        }
+        else if (parsed_line.tag == to_string(tag_))
+        {
+            if (!parsed_line.result.has_value() || parsed_line.result.value() != tag_result_response_t::OK)
+                throw imap_error("Enabling extensions failure.", "Line=`" + line + "`.");
+            has_more = false;
+        }
+        else
+            throw imap_error("Parsing failure.", "Line=`" + line + "`.");
+    }
+    reset_grammar_parser();
+    return enabled;
+}
+
+
+auto imap::select_responses(const string& command, mailbox_changes_t& changes) -> mailbox_stat_t
+{
+    dlg_->send(format(command));
 
     mailbox_stat_t stat;
     bool exists_found = false;
@@ -283,22 +664,32 @@ auto imap::select(const string& mailbox, bool read_only) -> mailbox_stat_t
                         {
                             if (value->token_type != grammar_token_t::token_type_t::ATOM)
                                 throw imap_error("Number expected for unseen.", "Line=`" + line + "`.");
-                            stat.messages_first_unseen = stoul(value->atom);
+                            stat.messages_first_unseen = stoul(string(value->atom));
                         }
                         else if (iequals(key->atom, "UIDNEXT"))
                         {
                             if (value->token_type != grammar_token_t::token_type_t::ATOM)
                                 throw imap_error("Number expected for uidnext.", "Line=`" + line + "`.");
-                            stat.uid_next = stoul(value->atom);
+                            stat.uid_next = stoul(string(value->atom));
                         }
                         else if (iequals(key->atom, "UIDVALIDITY"))
                         {
                             if (value->token_type != grammar_token_t::token_type_t::ATOM)
                                 throw imap_error("Number expected for uidvalidity.", "Line=`" + line + "`.");
-                            stat.uid_validity = stoul(value->atom);
+                            stat.uid_validity = stoul(string(value->atom));
+                        }
+                        else if (iequals(key->atom, "HIGHESTMODSEQ"))
+                        {
+                            if (value->token_type != grammar_token_t::token_type_t::ATOM)
+                                throw imap_error("Number expected for highestmodseq.", "Line=`" + line + "`.");
+                            stat.highest_modseq = stoull(string(value->atom));
                         }
                     }
                 }
+                else if (std::optional<fetch_response_t> response = parse_fetch_response())
+                    changes.changed.push_back(std::move(*response));
+                else if (std::optional<messages_set_t> vanished = parse_vanished())
+                    changes.vanished |= *vanished;
                 else
                 {
                     if (mandatory_part_.size() == 2 && mandatory_part_.front()->token_type == grammar_token_t::token_type_t::ATOM)
@@ -309,12 +700,12 @@ auto imap::select(const string& mailbox, bool read_only) -> mailbox_stat_t
                         mandatory_part_.pop_front();
                         if (iequals(key->atom, "EXISTS"))
                         {
-                            stat.messages_no = stoul(value->atom);
+                            stat.messages_no = stoul(string(value->atom));
                             exists_found = true;
                         }
                         else if (iequals(key->atom, "RECENT"))
                         {
-                            stat.messages_recent = stoul(value->atom);
+                            stat.messages_recent = stoul(string(value->atom));
                             recent_found = true;
                         }
                     }
@@ -357,8 +748,8 @@ void imap::fetch(const string& mailbox, unsigned long message_no, bool is_uid, m
 
 void imap::fetch(unsigned long message_no, message& msg, bool is_uid, bool header_only)
 {
-    list<messages_range_t> messages_range;
-    messages_range.push_back(imap::messages_range_t(message_no, message_no));
+    messages_set_t messages_range;
+    messages_range.insert(message_no);
     map<unsigned long, message> found_messages;
     fetch(messages_range, found_messages, is_uid, header_only, msg.line_policy());
     if (!found_messages.empty())
@@ -366,7 +757,7 @@ void imap::fetch(unsigned long message_no, message& msg, bool is_uid, bool heade
 }
 
 
-void imap::fetch(const list<messages_range_t>& messages_range, map<unsigned long, message>& found_messages, bool is_uids, bool header_only,
+void imap::fetch(const messages_set_t& messages_range, map<unsigned long, message>& found_messages, bool is_uids, bool header_only,
     codec::line_len_policy_t line_policy)
 {
     uint8_t fetch_opt = static_cast<uint8_t>(fetch_options_t::DEFAULT);
@@ -384,127 +775,393 @@ is being used for fetching a literal. That way, the EOL counting is properly per
 
 According to the RFC 3501 section 6.4.5, the untagged response of the fetch command is not mandatory. Thus, some servers return just the tagged response if
 no message is found.
-
-The fetch untagged responses provide messages. In the last tagged response the status is obtained. Then, string literals can be parsed to validate the MIME
-format.
 */
 map<unsigned long, message>
-imap::fetch(const list<messages_range_t>& messages_range, fetch_options_t options, codec::line_len_policy_t line_policy)
+imap::fetch(const messages_set_t& messages_range, fetch_options_t options, codec::line_len_policy_t line_policy)
 {
-    bool header_only = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::HEADER_ONLY));
-    bool is_uid = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::IS_UID));
-    bool is_flags = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::FLAGS));
     map<unsigned long, message> found_messages;
+    fetch(messages_range, options, [&found_messages](unsigned long message_no, message&& msg)
+        {
+            found_messages.emplace(message_no, move(msg));
+        },
+        line_policy);
+    return found_messages;
+}
 
-    if (messages_range.empty())
-        throw imap_error("Empty messages range.", "");
 
-    const string RFC822_TOKEN = string("RFC822") + (header_only ? ".HEADER" : "");
-    const string message_ids = messages_range_list_to_string(messages_range);
+/*
+Fetch responses without a literal, like the unsolicited flag updates, are not messages so they are skipped.
+*/
+void imap::fetch(const messages_set_t& messages_range, fetch_options_t options, const message_callback_t& callback,
+    codec::line_len_policy_t line_policy)
+{
+    bool is_uid = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::IS_UID));
+    auto parse = [line_policy](const string& msg_str, const vector<string>& flags)
+    {
+        message msg;
+        msg.line_policy(line_policy);
+        msg.parse(msg_str);
+        msg.flags(flags);
+        return msg;
+    };
 
-    string cmd;
-    if (is_uid)
-        cmd.append("UID ");
-    // TODO: Else branch also to put the RFC822 within parenthesis?
-    if (is_flags)
-        cmd.append("FETCH " + message_ids + TOKEN_SEPARATOR_STR + "(FLAGS " +  RFC822_TOKEN + ")");
-    else
-        cmd.append("FETCH " + message_ids + TOKEN_SEPARATOR_STR + RFC822_TOKEN);
-    dlg_->send(format(cmd));
+    if (parser_threads_ == 0)
+    {
+        auto on_response = [&](const fetch_response_t& response, string* literal)
+        {
+            if (literal == nullptr)
+                return;
+
+            message msg = parse(*literal, response.flags);
+            callback(is_uid ? response.uid : response.sequence_no, move(msg));
+        };
+        fetch_responses(fetch_command(messages_range, options), on_response);
+        return;
+    }
 
-    // Store messages as strings indexed by the messages number.
-    map<unsigned long, tuple<string, vector<string>>> msg_str;
+    // The pool is destroyed after the pending messages, so the parsing tasks own all their data.
+    thread_pool pool(parser_threads_);
+    deque<pair<unsigned long, future<message>>> pending;
+    auto deliver = [&pending, &callback](bool wait_all, deque<pair<unsigned long, future<message>>>::size_type max_pending)
+    {
+        while (!pending.empty() && (wait_all || pending.size() > max_pending || pending.front().second.wait_for(milliseconds(0)) == future_status::ready))
+        {
+            message msg = pending.front().second.get();
+            unsigned long message_no = pending.front().first;
+            pending.pop_front();
+            callback(message_no, move(msg));
+        }
+    };
+    auto on_response = [&](const fetch_response_t& response, string* literal)
+    {
+        if (literal == nullptr)
+            return;
+
+        auto task = make_shared<packaged_task<message()>>(
+            [parse, msg_str = move(*literal), flags = response.flags]() { return parse(msg_str, flags); });
+        pending.emplace_back(is_uid ? response.uid : response.sequence_no, task->get_future());
+        post(pool, [task]() { (*task)(); });
+        deliver(false, 2 * parser_threads_);
+    };
+    fetch_responses(fetch_command(messages_range, options), on_response);
+    deliver(true, 0);
+}
 
-    // Parse IMAP response into tokens defined by the grammar.
 
-    bool more_read = true;
-    while (more_read)
+/*
+An exception of the sink or of the callback stops calling both of them, and it is rethrown once the tagged response is read.
+*/
+void imap::fetch_literals(const messages_set_t& messages_range, const literal_sink_t& sink, fetch_options_t options,
+    const fetch_response_callback_t& callback)
+{
+    exception_ptr consumer_error;
+    literal_sink_ = [this, &sink, &consumer_error](const string& chunk)
     {
-        string line = dlg_->receive();
-        if (literal_state_ == string_literal_state_t::READING || parenthesis_list_counter_ > 0)
+        unsigned long sequence_no = 0;
+        try
         {
-            parse_grammar(line);
+            sequence_no = stoul(string(mandatory_part_.front()->atom));
         }
-        else
+        catch (const logic_error& exc)
         {
-            tag_result_response_t parsed_line = parse_tag_result(line);
-            if (parsed_line.tag == UNTAGGED_RESPONSE)
-                parse_grammar(parsed_line.response);
-            else if (parsed_line.tag == to_string(tag_))
-            {
-                if (parsed_line.result.value() != tag_result_response_t::OK)
-                    throw imap_error("Fetching message failure.", "");
-                more_read = false;
-            }
+            throw imap_error("Parsing failure.", exc.what());
+        }
+        if (consumer_error)
+            return;
+        try
+        {
+            sink(sequence_no, chunk);
+        }
+        catch (...)
+        {
+            consumer_error = current_exception();
+        }
+    };
+    auto on_response = [&callback, &consumer_error](const fetch_response_t& response, string*)
+    {
+        if (!callback || consumer_error)
+            return;
+        try
+        {
+            callback(response);
         }
+        catch (...)
+        {
+            consumer_error = current_exception();
+        }
+    };
+
+    try
+    {
+        fetch_responses(fetch_command(messages_range, options), on_response);
+    }
+    catch (...)
+    {
+        literal_sink_ = nullptr;
+        throw;
     }
+    literal_sink_ = nullptr;
+    if (consumer_error)
+        rethrow_exception(consumer_error);
+}
 
-    // Some servers return OK when no message is found. No further logic is required.
-    if (mandatory_part_.size() == 0)
-        return found_messages;
 
-    unsigned long uid_no = 0;
-    for (auto mand_part = mandatory_part_.begin(); mand_part != mandatory_part_.end(); mand_part++)
-    {
-        unsigned long sequence_no = stoul((*mand_part)->atom);
-        mand_part++;
-        if (!iequals((*mand_part)->atom, "FETCH"))
-            throw imap_error("Expecting the fetch atom.", "");
-        mand_part++;
+/*
+Unsolicited fetch responses, like the flag updates, have no envelope so they are skipped.
+*/
+map<unsigned long, imap::message_summary_t> imap::fetch_summaries(const messages_set_t& messages_range, bool is_uid,
+    const vector<string>& header_fields)
+{
+    if (messages_range.empty())
+        throw imap_error("Empty messages range.", "");
 
-        if ((*mand_part)->token_type == grammar_token_t::token_type_t::LIST)
+    map<unsigned long, message_summary_t> summaries;
+    string cmd = string(is_uid ? "UID " : "") + "FETCH " + messages_range.to_string() + TOKEN_SEPARATOR_STR +
+        "(UID FLAGS RFC822.SIZE ENVELOPE";
+    if (!header_fields.empty())
+        cmd += " BODY.PEEK" + string(1, OPTIONAL_BEGIN) + "HEADER.FIELDS (" + boost::join(header_fields, TOKEN_SEPARATOR_STR) + ")" + OPTIONAL_END;
+    cmd += ")";
+    fetch_responses(cmd, [this, is_uid, &summaries](const fetch_response_t& response, string* literal)
         {
-            auto data_list = (*mand_part);
-            for (auto token = data_list->parenthesized_list.begin(); token != data_list->parenthesized_list.end(); token++)
+            const grammar_token_t* envelope = find_fetch_item("ENVELOPE");
+            if (envelope == nullptr)
+                return;
+
+            message_summary_t summary;
+            summary.sequence_no = response.sequence_no;
+            summary.uid = response.uid;
+            summary.flags = response.flags;
+            const grammar_token_t* size = find_fetch_item("RFC822.SIZE");
+            if (size != nullptr)
             {
-                if ((*token)->token_type == grammar_token_t::token_type_t::ATOM)
+                try
                 {
-                    if (iequals((*token)->atom, "UID"))
-                    {
-                        token++;
-                        if (token == data_list->parenthesized_list.end())
-                            throw imap_error("No uid number when fetching a message.", "");
-                        try
-                        {
-                            uid_no = stoul((*token)->atom);
-                        }
-                        catch (const logic_error& exc)
-                        {
-                            throw imap_error("Parsing failure.", exc.what());
-                        }
-                    }
-                    else if (iequals((*token)->atom, "FLAGS"))
-                    {
-                        token++;
-                        if ((*token)->token_type == grammar_token_t::token_type_t::LIST)
-                            for (auto fetch_list = (*token)->parenthesized_list.begin(); fetch_list != (*token)->parenthesized_list.end(); fetch_list++)
-                                std::get<1>(msg_str[is_uid ? uid_no : sequence_no]).push_back((*fetch_list)->atom);
+                    summary.size = stoul(token_string(*size));
+                }
+                catch (const logic_error& exc)
+                {
+                    throw imap_error("Parsing failure.", exc.what());
+                }
+            }
+            parse_envelope(*envelope, summary);
+            if (literal != nullptr)
+                parse_header_fields(*literal, summary.header_fields);
+            summaries[is_uid ? response.uid : response.sequence_no] = move(summary);
+        });
+    return summaries;
+}
+
+
+map<unsigned long, imap::fetch_response_t> imap::fetch_flags(const messages_set_t& messages_range, bool is_uid)
+{
+    if (messages_range.empty())
+        throw imap_error("Empty messages range.", "");
+
+    map<unsigned long, fetch_response_t> responses;
+    string cmd = string(is_uid ? "UID " : "") + "FETCH " + messages_range.to_string() + TOKEN_SEPARATOR_STR + "(UID FLAGS)";
+    fetch_responses(cmd, [is_uid, &responses](const fetch_response_t& response, string*)
+        {
+            responses[is_uid ? response.uid : response.sequence_no] = response;
+        });
+    return responses;
+}
+
+
+/*
+According to the RFC 7162 section 3.1.4, the changed since modifier returns only the messages with a greater modification sequence, and the vanished
+modifier adds the vanished response with the removed UIDs. The fetch responses are handled by the pipeline, since the vanished response is not one of them.
+*/
+auto imap::fetch_changes(const messages_set_t& uids, unsigned long long modseq, bool vanished) -> mailbox_changes_t
+{
+    if (uids.empty())
+        throw imap_error("Empty messages range.", "");
+
+    string cmd = "UID FETCH " + uids.to_string() + " (UID FLAGS) (CHANGEDSINCE " + to_string(modseq) + (vanished ? " VANISHED)" : ")");
+    mailbox_changes_t changes;
+    vector<tag_result_response_t> results = pipeline({cmd}, [this, &changes]()
+        {
+            if (std::optional<fetch_response_t> response = parse_fetch_response())
+                changes.changed.push_back(std::move(*response));
+            else if (std::optional<messages_set_t> vanished_uids = parse_vanished())
+                changes.vanished |= *vanished_uids;
+        });
+    if (results.front().result.value() != tag_result_response_t::OK)
+        throw imap_error("Fetching message failure.", "Response=`" + results.front().response + "`.");
+    return changes;
+}
+
+
+map<unsigned long, imap::body_part_t> imap::fetch_structure(const messages_set_t& messages_range, bool is_uid)
+{
+    if (messages_range.empty())
+        throw imap_error("Empty messages range.", "");
+
+    map<unsigned long, body_part_t> structures;
+    string cmd = string(is_uid ? "UID " : "") + "FETCH " + messages_range.to_string() + TOKEN_SEPARATOR_STR + "(BODYSTRUCTURE)";
+    fetch_responses(cmd, [this, is_uid, &structures](const fetch_response_t& response, string*)
+        {
+            const grammar_token_t* body = find_fetch_item("BODYSTRUCTURE");
+            if (body == nullptr)
+                return;
+
+            body_part_t part;
+            parse_body_structure(*body, "", part);
+            structures[is_uid ? response.uid : response.sequence_no] = move(part);
+        });
+    return structures;
+}
+
+
+/*
+According to the RFC 3501 section 6.4.5, the `BODY.PEEK` data item does not set the seen flag.
+*/
+string imap::fetch_part(unsigned long uid, const string& section)
+{
+    return fetch_body_item(uid, "BODY.PEEK" + string(1, OPTIONAL_BEGIN) + section + OPTIONAL_END);
+}
+
+
+/*
+According to the RFC 3501 section 6.4.5, the partial fetch is given by the origin octet and the number of octets appended to the section within the angle
+brackets. The server returns less octets if the end of the section is reached.
+*/
+string imap::fetch_part(unsigned long uid, const string& section, unsigned long start, unsigned long count)
+{
+    return fetch_body_item(uid, "BODY.PEEK" + string(1, OPTIONAL_BEGIN) + section + OPTIONAL_END + "<" + to_string(start) + "." + to_string(count) + ">");
+}
+
+
+unsigned long imap::download(unsigned long uid, const range_sink_t& sink, unsigned long offset, unsigned long chunk_size, const string& section)
+{
+    if (chunk_size == 0)
+        throw imap_error("Zero chunk size.", "");
+
+    bool has_more = true;
+    while (has_more)
+    {
+        string chunk = fetch_part(uid, section, offset, chunk_size);
+        has_more = chunk.length() >= chunk_size;
+        if (!chunk.empty())
+            sink(offset, chunk);
+        offset += chunk.length();
+    }
+
+    std::optional<unsigned long> size = announced_size(uid, section);
+    if (size.has_value() && offset != *size)
+        throw imap_error("Download truncation.", "UID=`" + to_string(uid) + "`, offset=`" + to_string(offset) + "`, size=`" + to_string(*size) + "`.");
+    return offset;
+}
+
+
+/*
+The size of a multipart, and of the sections other than the part numbers, is not announced.
+*/
+std::optional<unsigned long> imap::announced_size(unsigned long uid, const string& section)
+{
+    std::optional<unsigned long> size;
+    if (section.empty())
+    {
+        fetch_responses("UID FETCH " + to_string(uid) + TOKEN_SEPARATOR_STR + "(RFC822.SIZE)",
+            [this, uid, &size](const fetch_response_t& response, string*)
+            {
+                const grammar_token_t* size_item = find_fetch_item("RFC822.SIZE");
+                if (response.uid != uid || size_item == nullptr)
+                    return;
+                try
+                {
+                    size = stoul(token_string(*size_item));
+                }
+                catch (const logic_error& exc)
+                {
+                    throw imap_error("Parsing failure.", exc.what());
+                }
+            });
+        return size;
+    }
+
+    map<unsigned long, body_part_t> structures = fetch_structure(messages_set_t{messages_range_t(uid, uid)}, true);
+    auto structure = structures.find(uid);
+    if (structure == structures.end())
+        return size;
+    std::function<void(const body_part_t&)> find_part = [&section, &size, &find_part](const body_part_t& part)
+    {
+        if (part.section == section && !iequals(part.type, "multipart"))
+            size = part.size;
+        for (const auto& p : part.parts)
+            find_part(p);
+    };
+    find_part(structure->second);
+    return size;
+}
+
+
+/*
+The tokens of each response are processed and dropped as soon as the response is complete, which is when neither a literal nor a parenthesized list is
+being read after a line is parsed.
+
+An exception of the callback does not interrupt reading the responses, otherwise the rest of them would be left on the connection. It is rethrown once
+the tagged response is read, and the callback is not called anymore.
+*/
+void imap::fetch_responses(const string& command, const fetch_literal_callback_t& callback)
+{
+    dlg_->send(format(command));
+    exception_ptr consumer_error;
+    try
+    {
+        bool more_read = true;
+        while (more_read)
+        {
+            string line = dlg_->receive();
+            if (literal_state_ == string_literal_state_t::READING || parenthesis_list_counter_ > 0)
+                parse_grammar(line);
+            else
+            {
+                tag_result_response_t parsed_line = parse_tag_result(line);
+                if (parsed_line.tag == UNTAGGED_RESPONSE)
+                    parse_grammar(parsed_line.response);
+                else if (parsed_line.tag == to_string(tag_))
+                {
+                    if (parsed_line.result.value() != tag_result_response_t::OK)
+                        throw imap_error("Fetching message failure.", "");
+                    more_read = false;
+                }
+            }
+
+            if (literal_state_ == string_literal_state_t::NONE && parenthesis_list_counter_ == 0 && !mandatory_part_.empty())
+            {
+                std::optional<fetch_response_t> response = parse_fetch_response();
+                if (response.has_value() && !consumer_error)
+                {
+                    string* literal = nullptr;
+                    string quoted;
+                    grammar_token_t* body = literal_sink_ ? nullptr : find_body_item();
+                    if (body != nullptr && body->token_type == grammar_token_t::token_type_t::LITERAL)
+                        literal = &body->literal;
+                    else if (body != nullptr && body->token_type == grammar_token_t::token_type_t::ATOM && !iequals(body->atom, "NIL"))
+                    {
+                        quoted = token_string(*body);
+                        literal = &quoted;
+                    }
+                    try
+                    {
+                        callback(*response, literal);
                     }
-                    else if (iequals((*token)->atom, RFC822_TOKEN))
+                    catch (...)
                     {
-                        token++;
-                        if ((*token)->token_type != grammar_token_t::token_type_t::LITERAL)
-                            throw imap_error("No literal when fetching a message.", "");
-                        std::get<0>(msg_str[is_uid ? uid_no : sequence_no]) = move((*token)->literal);
+                        consumer_error = current_exception();
                     }
                 }
+                reset_grammar_parser();
             }
         }
     }
-
-    // Extract string messages into the structure.
-
-    for (const auto& ms : msg_str)
+    catch (...)
     {
-        message msg;
-        msg.line_policy(line_policy);
-        msg.parse(std::get<0>(ms.second));
-        msg.flags(std::get<1>(ms.second));
-        found_messages.emplace(ms.first, move(msg));
+        reset_grammar_parser();
+        throw;
     }
-
-    reset_grammar_parser();
-    return found_messages;
+    if (consumer_error)
+        rethrow_exception(consumer_error);
 }
 
 
@@ -518,18 +1175,21 @@ void imap::append(const list<string>& folder_name, const message& msg)
 
 void imap::append(const string& folder_name, const message& msg)
 {
-    string msg_str;
-    msg.format(msg_str, message_format_options_t{true, false});
+    append(folder_name, formatted_message(msg));
+}
+
 
+void imap::append(const string& folder_name, const formatted_message& msg)
+{
     string cmd = "APPEND " + to_astring(folder_name);
-    cmd.append(" {" + to_string(msg_str.size()) + "}");
+    cmd.append(" {" + to_string(msg.content().size()) + "}");
     dlg_->send(format(cmd));
     string line = dlg_->receive();
     tag_result_response_t parsed_line = parse_tag_result(line);
     if (parsed_line.result == tag_result_response_t::BAD || parsed_line.tag != CONTINUE_RESPONSE)
         throw imap_error("Message appending failure.", "Response=`" + parsed_line.response + "`.");
 
-    dlg_->send(msg_str);
+    dlg_->send(msg.content());
     bool has_more = true;
     while (has_more)
     {
@@ -549,106 +1209,57 @@ void imap::append(const string& folder_name, const message& msg)
 
 auto imap::statistics(const string& mailbox, unsigned int info) -> mailbox_stat_t
 {
-    // It doesn't like search terms it doesn't recognize.
-    // Some older protocol versions or some servers may not support them.
-    // So unseen uidnext and uidvalidity are optional.
-    string cmd = "STATUS " + to_astring(mailbox) + " (messages recent";
-    if (info & mailbox_stat_t::UNSEEN)
-        cmd += " unseen";
-    if (info & mailbox_stat_t::UID_NEXT)
-        cmd += " uidnext";
-    if (info & mailbox_stat_t::UID_VALIDITY)
-        cmd += " uidvalidity";
-    cmd += ")";
-
-    dlg_->send(format(cmd));
     mailbox_stat_t stat;
-
-    bool has_more = true;
-    try
-    {
-        while (has_more)
+    bool status_found = false;
+    vector<tag_result_response_t> results = pipeline({status_command(mailbox, info)}, [this, &stat, &status_found]()
         {
-            reset_grammar_parser();
-            string line = dlg_->receive();
-            tag_result_response_t parsed_line = parse_tag_result(line);
+            if (parse_status(stat).has_value())
+                status_found = true;
+        });
+    if (results.front().result.value() != tag_result_response_t::OK)
+        throw imap_error("Getting statistics failure.", "Line=`" + results.front().to_string() + "`.");
+    if (!status_found)
+        throw imap_error("No messages or recent messages found.", "");
+    return stat;
+}
 
-            if (parsed_line.tag == UNTAGGED_RESPONSE)
-            {
-                parse_grammar(parsed_line.response);
-                if (!iequals(mandatory_part_.front()->atom, "STATUS"))
-                    throw imap_error("Expecting the status atom.", "Line=`" + line + "`.");
-                mandatory_part_.pop_front();
 
-                bool mess_found = false, recent_found = false;
-                for (auto it = mandatory_part_.begin(); it != mandatory_part_.end(); it++)
-                    if ((*it)->token_type == grammar_token_t::token_type_t::LIST && (*it)->parenthesized_list.size() >= 2)
-                    {
-                        bool key_found = false;
-                        string key;
-                        auto mp = *it;
-                        for(auto il = mp->parenthesized_list.begin(); il != mp->parenthesized_list.end(); ++il)
-                        {
-                            const string& value = (*il)->atom;
-                            if (key_found)
-                            {
-                                if (iequals(key, "MESSAGES"))
-                                {
-                                    stat.messages_no = stoul(value);
-                                    mess_found = true;
-                                }
-                                else if (iequals(key, "RECENT"))
-                                {
-                                    stat.messages_recent = stoul(value);
-                                    recent_found = true;
-                                }
-                                else if (iequals(key, "UNSEEN"))
-                                {
-                                    stat.messages_unseen = stoul(value);
-                                }
-                                else if (iequals(key, "UIDNEXT"))
-                                {
-                                    stat.uid_next = stoul(value);
-                                }
-                                else if (iequals(key, "UIDVALIDITY"))
-                                {
-                                    stat.uid_validity = stoul(value);
-                                }
-                                key_found = false;
-                            }
-                            else
-                            {
-                                key = value;
-                                key_found = true;
-                            }
-                        }
-                    }
-                // The MESSAGES and RECENT are required.
-                if (!mess_found || !recent_found)
-                    throw imap_error("No messages or recent messages found.", "");
-            }
-            else if (parsed_line.tag == to_string(tag_))
-            {
-                if (parsed_line.result.value() == tag_result_response_t::OK)
-                    has_more = false;
-                else
-                    throw imap_error("Getting statistics failure.", "Line=`" + line + "`.");
-            }
-            else
-                throw imap_error("Parsing failure.", "Tag=`" + parsed_line.tag + "`.");
-        }
-    }
-    catch (const invalid_argument& exc)
-    {
-        throw imap_error("Parsing failure.", exc.what());
-    }
-    catch (const out_of_range& exc)
+/*
+The status responses are matched with the mailboxes by the names, so a response for a mailbox not asked for is ignored. According to the RFC 3501 section
+5.1, the `INBOX` name is case insensitive, so the server may reply with it in another case.
+*/
+auto imap::mailboxes_statistics(const list<string>& mailboxes, unsigned int info) -> mailboxes_statistics_t
+{
+    vector<string> commands;
+    for (const auto& mailbox : mailboxes)
+        commands.push_back(status_command(mailbox, info));
+
+    mailboxes_statistics_t report;
+    vector<tag_result_response_t> results = pipeline(commands, [this, &mailboxes, &report]()
+        {
+            mailbox_stat_t stat;
+            std::optional<string> mailbox = parse_status(stat);
+            if (!mailbox.has_value())
+                return;
+            auto requested = std::find_if(mailboxes.begin(), mailboxes.end(), [&mailbox](const string& name)
+                {
+                    return name == *mailbox || (iequals(name, INBOX_MAILBOX) && iequals(*mailbox, INBOX_MAILBOX));
+                });
+            if (requested != mailboxes.end())
+                report.statistics[*requested] = stat;
+        });
+
+    auto mailbox = mailboxes.begin();
+    for (const auto& result : results)
     {
-        throw imap_error("Parsing failure.", exc.what());
+        if (result.result.value() != tag_result_response_t::OK)
+        {
+            report.statistics.erase(*mailbox);
+            report.failures[*mailbox] = result.response;
+        }
+        mailbox++;
     }
-
-    reset_grammar_parser();
-    return stat;
+    return report;
 }
 
 
@@ -705,7 +1316,7 @@ void imap::remove(unsigned long message_no, bool is_uid)
                     throw imap_error("No mandatory part.", "Response=`" + parsed_line.response + "`.");
                 auto fetch_token = mandatory_part_.front();
                 if (!iequals(fetch_token->atom, "FETCH"))
-                    throw imap_error("Parsing failure.", "Tag=`" + fetch_token->atom + "`.");
+                    throw imap_error("Parsing failure.", "Tag=`" + string(fetch_token->atom) + "`.");
                 mandatory_part_.pop_front();
 
                 // Check the list with flags.
@@ -716,7 +1327,7 @@ void imap::remove(unsigned long message_no, bool is_uid)
                 if (flags_token_list->token_type != grammar_token_t::token_type_t::LIST)
                     throw imap_error("Expecting the list.", "Line=`" + line + "`.");
 
-                std::shared_ptr<grammar_token_t> uid_token = nullptr;
+                grammar_token_t* uid_token = nullptr;
                 auto uid_token_it = flags_token_list->parenthesized_list.begin();
                 do
                     if (iequals((*uid_token_it)->atom, "UID"))
@@ -738,7 +1349,7 @@ void imap::remove(unsigned long message_no, bool is_uid)
                     msg_no_token = uid_token;
                 }
 
-                if (msg_no_token->token_type != grammar_token_t::token_type_t::ATOM || stoul(msg_no_token->atom) != message_no)
+                if (msg_no_token->token_type != grammar_token_t::token_type_t::ATOM || stoul(string(msg_no_token->atom)) != message_no)
                     throw imap_error("Deleting message failure.", "");
 
                 continue;
@@ -776,6 +1387,41 @@ void imap::remove(unsigned long message_no, bool is_uid)
 }
 
 
+/*
+According to the RFC 4315 section 2.1, the UID expunge command expunges only the given messages which are marked as deleted, so other messages marked as
+deleted are kept. The store and expunge commands are sent in a single batch, since if the store fails, the UID expunge removes at most the given messages.
+*/
+void imap::remove(const messages_set_t& uids)
+{
+    if (!has_capability("UIDPLUS"))
+        throw imap_error("No UIDPLUS extension.", "");
+
+    vector<string> commands = store_commands(uids, store_op_t::ADD, {"\\Deleted"}, true, true);
+    for (const auto& sequence_set : uids.to_strings(SEQUENCE_SET_MAX_LENGTH))
+        commands.push_back("UID EXPUNGE " + sequence_set);
+
+    for (const auto& result : pipeline(commands, []() {}))
+        if (result.result.value() != tag_result_response_t::OK)
+            throw imap_error("Deleting message failure.", "Response=`" + result.response + "`.");
+}
+
+
+auto imap::store_flags(const messages_set_t& messages_range, store_op_t op, const vector<string>& flags, bool silent, bool is_uid) ->
+    map<unsigned long, fetch_response_t>
+{
+    map<unsigned long, fetch_response_t> responses;
+    vector<tag_result_response_t> results = pipeline(store_commands(messages_range, op, flags, silent, is_uid), [this, is_uid, &responses]()
+        {
+            if (std::optional<fetch_response_t> response = parse_fetch_response())
+                responses[is_uid ? response->uid : response->sequence_no] = move(*response);
+        });
+    for (const auto& result : results)
+        if (result.result.value() != tag_result_response_t::OK)
+            throw imap_error("Storing flags failure.", "Response=`" + result.response + "`.");
+    return responses;
+}
+
+
 void imap::search(const list<imap::search_condition_t>& conditions, list<unsigned long>& results, bool want_uids)
 {
     string cond_str;
@@ -789,6 +1435,97 @@ void imap::search(const list<imap::search_condition_t>& conditions, list<unsigne
 }
 
 
+/*
+According to the RFC 4731, the result items are given in the ESEARCH response as the pairs of the item name and its value, after the optional command tag
+and the UID indicator. The response is sent even if no message is found.
+*/
+auto imap::search(const list<imap::search_condition_t>& conditions, unsigned int returned, bool want_uids) -> search_result_t
+{
+    string cond_str = boost::join(conditions | boost::adaptors::transformed([](const search_condition_t& condition) { return condition.imap_string; }),
+        TOKEN_SEPARATOR_STR);
+    search_result_t result;
+    if (!has_capability("ESEARCH"))
+    {
+        list<unsigned long> found;
+        search(cond_str, found, want_uids);
+        if (returned & search_result_t::COUNT)
+            result.count = found.size();
+        if (found.empty())
+            return result;
+        if (returned & search_result_t::MIN)
+            result.min = *std::min_element(found.begin(), found.end());
+        if (returned & search_result_t::MAX)
+            result.max = *std::max_element(found.begin(), found.end());
+        if (returned & search_result_t::ALL)
+            for (auto id : found)
+                result.all.insert(id);
+        return result;
+    }
+
+    vector<string> items;
+    if (returned & search_result_t::MIN)
+        items.push_back("MIN");
+    if (returned & search_result_t::MAX)
+        items.push_back("MAX");
+    if (returned & search_result_t::COUNT)
+        items.push_back("COUNT");
+    if (returned & search_result_t::ALL)
+        items.push_back("ALL");
+    dlg_->send(format(string(want_uids ? "UID " : "") + "SEARCH RETURN (" + boost::join(items, TOKEN_SEPARATOR_STR) + ")" + TOKEN_SEPARATOR_STR +
+        cond_str));
+
+    bool has_more = true;
+    try
+    {
+        while (has_more)
+        {
+            reset_grammar_parser();
+            string line = dlg_->receive();
+            tag_result_response_t parsed_line = parse_tag_result(line);
+            if (parsed_line.tag == UNTAGGED_RESPONSE)
+            {
+                parse_grammar(parsed_line.response);
+                if (mandatory_part_.empty() || !iequals(mandatory_part_.front()->atom, "ESEARCH"))
+                    continue;
+
+                for (auto token = std::next(mandatory_part_.begin()); token != mandatory_part_.end(); token++)
+                {
+                    if ((*token)->token_type != grammar_token_t::token_type_t::ATOM || iequals((*token)->atom, "UID"))
+                        continue;
+                    auto value = std::next(token);
+                    if (value == mandatory_part_.end() || (*value)->token_type != grammar_token_t::token_type_t::ATOM)
+                        throw imap_error("Parsing failure.", "Line=`" + line + "`.");
+                    if (iequals((*token)->atom, "MIN"))
+                        result.min = stoul(string((*value)->atom));
+                    else if (iequals((*token)->atom, "MAX"))
+                        result.max = stoul(string((*value)->atom));
+                    else if (iequals((*token)->atom, "COUNT"))
+                        result.count = stoul(string((*value)->atom));
+                    else if (iequals((*token)->atom, "ALL"))
+                        result.all = messages_set_t::from_string((*value)->atom);
+                    token = value;
+                }
+            }
+            else if (parsed_line.tag == to_string(tag_))
+            {
+                if (parsed_line.result.value() != tag_result_response_t::OK)
+                    throw imap_error("Search mailbox failure.", "Line=`" + line + "`.");
+                has_more = false;
+            }
+            else
+                throw imap_error("Incorrect tag parsed.", "Tag=`" + parsed_line.tag + "`.");
+        }
+    }
+    catch (const logic_error& exc)
+    {
+        reset_grammar_parser();
+        throw imap_error("Parsing failure.", exc.what());
+    }
+    reset_grammar_parser();
+    return result;
+}
+
+
 bool imap::create_folder(const string& folder_name)
 {
     dlg_->send(format("CREATE " + to_astring(folder_name)));
@@ -833,7 +1570,7 @@ auto imap::list_folders(const string& folder_name) -> mailbox_folder_t
                 auto token = mandatory_part_.front();
                 mandatory_part_.pop_front();
                 if (!iequals(token->atom, "LIST"))
-                    throw imap_error("Expecting the list atom.", "Atom=`" + token->atom + "`.");
+                    throw imap_error("Expecting the list atom.", "Atom=`" + string(token->atom) + "`.");
 
                 if (mandatory_part_.size() < 3)
                     throw imap_error("Listing folders failure.", "");
@@ -943,6 +1680,17 @@ string imap::connect()
         throw imap_error("Incorrect tag.", "Tag=`" + parsed_line.tag + "`.");
     if (!parsed_line.result.has_value() || parsed_line.result.value() != tag_result_response_t::OK)
         throw imap_error("Connection to server failure.", "Line=`" + line + "`.");
+
+    // Servers usually announce the capabilities within the greeting, which saves the capability command later.
+    const string CAPABILITY_CODE = string(1, OPTIONAL_BEGIN) + "CAPABILITY";
+    string::size_type code_end = parsed_line.response.find(OPTIONAL_END);
+    if (istarts_with(parsed_line.response, CAPABILITY_CODE) && code_end != string::npos)
+    {
+        reset_grammar_parser();
+        parse_grammar(parsed_line.response.substr(0, code_end + 1));
+        store_capabilities(optional_part_);
+        reset_grammar_parser();
+    }
     return parsed_line.response;
 }
 
@@ -958,6 +1706,8 @@ void imap::switch_tls()
         throw imap_error("Start TLS refused by server.", "");
 
     dlg_ = dialog_ssl::to_ssl(dlg_, *ssl_options_);
+    // Capabilities announced before the TLS negotiation must not be trusted.
+    capabilities_.reset();
 }
 
 
@@ -986,45 +1736,121 @@ void imap::auth_login(const string& username, const string& password)
 }
 
 
-void imap::search(const string& conditions, list<unsigned long>& results, bool want_uids)
+/*
+According to the RFC 3501 section 6.2.2, the server requests the client response by the continuation. When the initial response is already sent, any
+continuation carries the failure details, and it is cancelled by the empty response, so the server replies with the tagged failure.
+*/
+void imap::auth_sasl(const string& mechanism, const string& initial_response)
 {
-    string cmd;
-    if (want_uids)
-        cmd.append("UID ");
-    cmd.append("SEARCH " + conditions);
+    const string response = base64::encode_line(initial_response);
+    bool response_sent = has_capability("SASL-IR");
+    string cmd = "AUTHENTICATE " + mechanism;
+    if (response_sent)
+        cmd += TOKEN_SEPARATOR_STR + response;
     dlg_->send(format(cmd));
 
     bool has_more = true;
-    try
+    while (has_more)
     {
-        while (has_more)
+        string line = dlg_->receive();
+        if (line.compare(0, CONTINUE_RESPONSE.length(), CONTINUE_RESPONSE) == 0)
         {
-            reset_grammar_parser();
-            string line = dlg_->receive();
-            tag_result_response_t parsed_line = parse_tag_result(line);
-            if (parsed_line.tag == UNTAGGED_RESPONSE)
-            {
-                parse_grammar(parsed_line.response);
+            dlg_->send(response_sent ? "" : response);
+            response_sent = true;
+            continue;
+        }
 
-                auto search_token = mandatory_part_.front();
-                // ignore other responses, although not sure whether this is by the rfc or not
-                if (search_token->token_type == grammar_token_t::token_type_t::ATOM && !iequals(search_token->atom, "SEARCH"))
-                    continue;
-                mandatory_part_.pop_front();
+        tag_result_response_t parsed_line = parse_tag_result(line);
+        if (parsed_line.tag == UNTAGGED_RESPONSE)
+            continue;
+        if (parsed_line.tag != to_string(tag_))
+            throw imap_error("Incorrect tag.", "Tag=`" + parsed_line.tag + "`.");
+        if (!parsed_line.result.has_value() || parsed_line.result.value() != tag_result_response_t::OK)
+            throw imap_error("Authentication failure.", "Line=`" + line + "`.");
 
-                for (auto it = mandatory_part_.begin(); it != mandatory_part_.end(); it++)
-                    if ((*it)->token_type == grammar_token_t::token_type_t::ATOM)
-                    {
-                        const unsigned long idx = stoul((*it)->atom);
-                        if (idx == 0)
-                            throw imap_error("Incorrect message id.", "Line=`" + line + "`.");
-                        results.push_back(idx);
-                    }
-            }
-            else if (parsed_line.tag == to_string(tag_))
-            {
-                if (parsed_line.result.value() != tag_result_response_t::OK)
-                    throw imap_error("Search mailbox failure.", "Line=`" + line + "`.");
+        has_more = false;
+    }
+    // Authenticated session may announce different capabilities.
+    capabilities_.reset();
+}
+
+
+bool imap::has_capability(const string& capability)
+{
+    if (!capabilities_.has_value())
+        read_capabilities();
+    return any_of(capabilities_->begin(), capabilities_->end(), [&capability](const string& c) { return iequals(c, capability); });
+}
+
+
+void imap::read_capabilities()
+{
+    dlg_->send(format("CAPABILITY"));
+    capabilities_ = vector<string>();
+
+    bool has_more = true;
+    while (has_more)
+    {
+        reset_grammar_parser();
+        string line = dlg_->receive();
+        tag_result_response_t parsed_line = parse_tag_result(line);
+        if (parsed_line.tag == UNTAGGED_RESPONSE)
+        {
+            parse_grammar(parsed_line.response);
+            store_capabilities(mandatory_part_);
+        }
+        else if (parsed_line.tag == to_string(tag_))
+        {
+            if (!parsed_line.result.has_value() || parsed_line.result.value() != tag_result_response_t::OK)
+                throw imap_error("Reading capabilities failure.", "Line=`" + line + "`.");
+            has_more = false;
+        }
+        else
+            throw imap_error("Incorrect tag.", "Tag=`" + parsed_line.tag + "`.");
+    }
+    reset_grammar_parser();
+}
+
+
+void imap::search(const string& conditions, list<unsigned long>& results, bool want_uids)
+{
+    string cmd;
+    if (want_uids)
+        cmd.append("UID ");
+    cmd.append("SEARCH " + conditions);
+    dlg_->send(format(cmd));
+
+    bool has_more = true;
+    try
+    {
+        while (has_more)
+        {
+            reset_grammar_parser();
+            string line = dlg_->receive();
+            tag_result_response_t parsed_line = parse_tag_result(line);
+            if (parsed_line.tag == UNTAGGED_RESPONSE)
+            {
+                parse_grammar(parsed_line.response);
+
+                auto search_token = mandatory_part_.front();
+                // ignore other responses, although not sure whether this is by the rfc or not
+                if (search_token->token_type == grammar_token_t::token_type_t::ATOM && !iequals(search_token->atom, "SEARCH"))
+                    continue;
+                mandatory_part_.pop_front();
+
+                for (auto it = mandatory_part_.begin(); it != mandatory_part_.end(); it++)
+                    if ((*it)->token_type == grammar_token_t::token_type_t::ATOM)
+                    {
+                        const unsigned long idx = stoul(string((*it)->atom));
+                        if (idx == 0)
+                            throw imap_error("Incorrect message id.", "Line=`" + line + "`.");
+                        results.push_back(idx);
+                    }
+            }
+            else if (parsed_line.tag == to_string(tag_))
+            {
+                if (parsed_line.result.value() != tag_result_response_t::OK)
+                    throw imap_error("Search mailbox failure.", "Line=`" + line + "`.");
 
                 has_more = false;
             }
@@ -1046,6 +1872,105 @@ void imap::search(const string& conditions, list<unsigned long>& results, bool w
 }
 
 
+/*
+According to the RFC 2177, the idle command is answered by the continuation, after which the server sends the untagged responses as the mailbox changes.
+The idling is finished by the `DONE` line, then the server completes the idle command. The server may drop the connection idling for more than thirty
+minutes, so the idle command is finished and issued again after the renewal period.
+
+While waiting for the server, the stop flag is checked once a second at least. An exception of the callback finishes the idling, and it is rethrown after
+the idle command is completed.
+*/
+void imap::idle(const idle_callback_t& callback, milliseconds renewal)
+{
+    const milliseconds STOP_CHECK_INTERVAL(1000);
+    idle_stopped_ = false;
+    exception_ptr callback_error;
+    auto pass_response = [this, &callback, &callback_error](const string& response)
+    {
+        if (callback_error)
+            return false;
+        try
+        {
+            return idle_response(response, callback);
+        }
+        catch (const dialog_error&)
+        {
+            throw;
+        }
+        catch (...)
+        {
+            callback_error = current_exception();
+            return false;
+        }
+    };
+
+    bool idling = true;
+    while (idling)
+    {
+        dlg_->send(format("IDLE"));
+        bool has_continued = false;
+        while (!has_continued)
+        {
+            string line = dlg_->receive();
+            tag_result_response_t parsed_line = parse_tag_result(line);
+            if (parsed_line.tag == CONTINUE_RESPONSE)
+                has_continued = true;
+            else if (parsed_line.tag == UNTAGGED_RESPONSE)
+                idling = pass_response(parsed_line.response) && idling;
+            else
+                throw imap_error("Idle failure.", "Line=`" + line + "`.");
+        }
+
+        const auto renewal_time = steady_clock::now() + renewal;
+        while (idling && !idle_stopped_ && steady_clock::now() < renewal_time)
+        {
+            milliseconds wait = std::min(STOP_CHECK_INTERVAL, std::chrono::duration_cast<milliseconds>(renewal_time - steady_clock::now()));
+            if (!dlg_->wait_read(wait))
+                continue;
+
+            string line = dlg_->receive();
+            tag_result_response_t parsed_line = parse_tag_result(line);
+            if (parsed_line.tag != UNTAGGED_RESPONSE)
+                throw imap_error("Idle failure.", "Line=`" + line + "`.");
+            idling = pass_response(parsed_line.response);
+        }
+        if (idle_stopped_)
+            idling = false;
+
+        dlg_->send("DONE");
+        bool has_completed = false;
+        while (!has_completed)
+        {
+            string line = dlg_->receive();
+            tag_result_response_t parsed_line = parse_tag_result(line);
+            if (parsed_line.tag == UNTAGGED_RESPONSE)
+            {
+                if (idling)
+                    idling = pass_response(parsed_line.response);
+                else
+                    idle_response(parsed_line.response, [](const idle_event_t&) { return false; });
+            }
+            else if (parsed_line.tag == to_string(tag_))
+            {
+                if (parsed_line.result.value() != tag_result_response_t::OK)
+                    throw imap_error("Idle failure.", "Line=`" + line + "`.");
+                has_completed = true;
+            }
+            else
+                throw imap_error("Idle failure.", "Line=`" + line + "`.");
+        }
+    }
+    if (callback_error)
+        rethrow_exception(callback_error);
+}
+
+
+void imap::idle_stop()
+{
+    idle_stopped_ = true;
+}
+
+
 void imap::start_tls(bool is_tls)
 {
     is_start_tls_ = is_tls;
@@ -1058,6 +1983,12 @@ void imap::ssl_options(const std::optional<dialog_ssl::ssl_options_t> options)
 }
 
 
+void imap::parser_threads(unsigned threads)
+{
+    parser_threads_ = threads;
+}
+
+
 string imap::folder_delimiter()
 {
     try
@@ -1082,7 +2013,7 @@ string imap::folder_delimiter()
                     auto it = mandatory_part_.begin();
                     if ((*(++it))->token_type != grammar_token_t::token_type_t::ATOM)
                         throw imap_error("Incorrect atom parsed.", "");
-                    folder_delimiter_ = trim_copy_if((*it)->atom, [](char c ){ return c == QUOTED_STRING_SEPARATOR_CHAR; });
+                    folder_delimiter_ = trim_copy_if(string((*it)->atom), [](char c ){ return c == QUOTED_STRING_SEPARATOR_CHAR; });
                     reset_grammar_parser();
                 }
                 else if (parsed_line.tag == to_string(tag_))
@@ -1107,6 +2038,245 @@ string imap::folder_delimiter()
 }
 
 
+/*
+According to the RFC 3501 section 5.5, the client may send another command without waiting for the completion of the previous one, if the commands do
+not depend on each other. The commands are written in windows of at most `PIPELINE_WINDOW_LENGTH` characters, and the responses of a window are read
+before the next one is written. Otherwise, a server replying to the first commands while the client still writes the others could fill both socket
+buffers, and neither side would read. A window fits into the socket buffers, so a batch costs a single round trip per window.
+
+An exception of the handler does not interrupt reading the responses, otherwise the rest of them would be left on the connection.
+*/
+auto imap::pipeline(const vector<string>& commands, const std::function<void()>& handler) -> vector<tag_result_response_t>
+{
+    vector<tag_result_response_t> results(commands.size());
+    exception_ptr handler_error;
+    vector<string>::size_type next_command = 0;
+    reset_grammar_parser();
+    try
+    {
+        while (next_command < commands.size())
+        {
+            string batch;
+            map<string, vector<string>::size_type> pending_tags;
+            do
+            {
+                batch += format(commands[next_command]) + codec::END_OF_LINE;
+                pending_tags[to_string(tag_)] = next_command;
+                next_command++;
+            }
+            while (next_command < commands.size() && batch.length() + commands[next_command].length() < PIPELINE_WINDOW_LENGTH);
+            dlg_->send_raw(batch);
+
+            while (!pending_tags.empty())
+            {
+                string line = dlg_->receive();
+                if (literal_state_ == string_literal_state_t::READING || parenthesis_list_counter_ > 0)
+                    parse_grammar(line);
+                else
+                {
+                    tag_result_response_t parsed_line = parse_tag_result(line);
+                    if (parsed_line.tag == UNTAGGED_RESPONSE)
+                        parse_grammar(parsed_line.response);
+                    else
+                    {
+                        auto pending_tag = pending_tags.find(parsed_line.tag);
+                        if (pending_tag == pending_tags.end() || !parsed_line.result.has_value())
+                            throw imap_error("Parsing failure.", "Line=`" + line + "`.");
+                        results[pending_tag->second] = parsed_line;
+                        pending_tags.erase(pending_tag);
+                        continue;
+                    }
+                }
+
+                if (literal_state_ == string_literal_state_t::NONE && parenthesis_list_counter_ == 0 && !mandatory_part_.empty())
+                {
+                    if (!handler_error)
+                    {
+                        try
+                        {
+                            handler();
+                        }
+                        catch (...)
+                        {
+                            handler_error = current_exception();
+                        }
+                    }
+                    reset_grammar_parser();
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        reset_grammar_parser();
+        throw;
+    }
+    reset_grammar_parser();
+    if (handler_error)
+        rethrow_exception(handler_error);
+    return results;
+}
+
+
+/*
+According to the RFC 3501 section 7.3 and 7.4, the mailbox size and the expunged message are given by the number followed by the atom, and the flag changes
+by the fetch response. With the QRESYNC extension enabled, the removed messages are given by the vanished response instead. The server closing the connection sends the bye response.
+*/
+bool imap::idle_response(const string& response, const idle_callback_t& callback)
+{
+    idle_event_t event;
+    bool is_event = false;
+    try
+    {
+        reset_grammar_parser();
+        parse_grammar(response);
+        // A fetch response may continue with a literal or a list in the following lines.
+        while (literal_state_ == string_literal_state_t::READING || parenthesis_list_counter_ > 0)
+            parse_grammar(dlg_->receive());
+
+        if (!mandatory_part_.empty() && iequals(mandatory_part_.front()->atom, "BYE"))
+            throw imap_error("Idle failure.", "Response=`" + response + "`.");
+        std::optional<fetch_response_t> fetch_response = parse_fetch_response();
+        std::optional<messages_set_t> vanished = parse_vanished();
+        if (fetch_response.has_value())
+        {
+            event.event_type = idle_event_t::event_type_t::FETCH;
+            event.number = fetch_response->sequence_no;
+            event.response = std::move(*fetch_response);
+            is_event = true;
+        }
+        else if (vanished.has_value())
+        {
+            event.event_type = idle_event_t::event_type_t::VANISHED;
+            event.vanished = std::move(*vanished);
+            is_event = true;
+        }
+        else if (mandatory_part_.size() == 2 && mandatory_part_.back()->token_type == grammar_token_t::token_type_t::ATOM)
+        {
+            const string_view kind = mandatory_part_.back()->atom;
+            is_event = true;
+            if (iequals(kind, "EXISTS"))
+                event.event_type = idle_event_t::event_type_t::EXISTS;
+            else if (iequals(kind, "RECENT"))
+                event.event_type = idle_event_t::event_type_t::RECENT;
+            else if (iequals(kind, "EXPUNGE"))
+                event.event_type = idle_event_t::event_type_t::EXPUNGE;
+            else
+                is_event = false;
+            if (is_event)
+                event.number = stoul(string(mandatory_part_.front()->atom));
+        }
+    }
+    catch (const logic_error& exc)
+    {
+        reset_grammar_parser();
+        throw imap_error("Parsing failure.", exc.what());
+    }
+    catch (...)
+    {
+        reset_grammar_parser();
+        throw;
+    }
+    reset_grammar_parser();
+    return is_event ? callback(event) : true;
+}
+
+
+/*
+According to the RFC 7162 section 3.2.10, the vanished response is given by the UIDs, optionally preceded by the earlier tag.
+*/
+auto imap::parse_vanished() const -> std::optional<messages_set_t>
+{
+    if (mandatory_part_.size() < 2 || !iequals(mandatory_part_.front()->atom, "VANISHED"))
+        return std::nullopt;
+    if (mandatory_part_.back()->token_type != grammar_token_t::token_type_t::ATOM)
+        return std::nullopt;
+    return messages_set_t::from_string(mandatory_part_.back()->atom);
+}
+
+
+/*
+Some older protocol versions or some servers may not support the unseen, uidnext, uidvalidity and highestmodseq items, so they are asked only if needed.
+*/
+string imap::status_command(const string& mailbox, unsigned int info)
+{
+    string cmd = "STATUS " + to_astring(mailbox) + " (messages recent";
+    if (info & mailbox_stat_t::UNSEEN)
+        cmd += " unseen";
+    if (info & mailbox_stat_t::UID_NEXT)
+        cmd += " uidnext";
+    if (info & mailbox_stat_t::UID_VALIDITY)
+        cmd += " uidvalidity";
+    if (info & mailbox_stat_t::HIGHEST_MODSEQ)
+        cmd += " highestmodseq";
+    cmd += ")";
+    return cmd;
+}
+
+
+/*
+According to the RFC 3501 section 7.2.4, the status response is the mailbox name followed by the list of the status items, given as pairs of the item name
+and its value.
+*/
+auto imap::parse_status(mailbox_stat_t& stat) const -> std::optional<string>
+{
+    if (mandatory_part_.size() < 3 || !iequals(mandatory_part_.front()->atom, "STATUS"))
+        return std::nullopt;
+
+    auto token = std::next(mandatory_part_.begin());
+    string mailbox = token_string(**token);
+    bool mess_found = false, recent_found = false;
+    try
+    {
+        for (++token; token != mandatory_part_.end(); token++)
+            if ((*token)->token_type == grammar_token_t::token_type_t::LIST && (*token)->parenthesized_list.size() >= 2)
+            {
+                bool key_found = false;
+                string key;
+                for (auto item : (*token)->parenthesized_list)
+                {
+                    const string value(item->atom);
+                    if (key_found)
+                    {
+                        if (iequals(key, "MESSAGES"))
+                        {
+                            stat.messages_no = stoul(value);
+                            mess_found = true;
+                        }
+                        else if (iequals(key, "RECENT"))
+                        {
+                            stat.messages_recent = stoul(value);
+                            recent_found = true;
+                        }
+                        else if (iequals(key, "UNSEEN"))
+                            stat.messages_unseen = stoul(value);
+                        else if (iequals(key, "UIDNEXT"))
+                            stat.uid_next = stoul(value);
+                        else if (iequals(key, "UIDVALIDITY"))
+                            stat.uid_validity = stoul(value);
+                        else if (iequals(key, "HIGHESTMODSEQ"))
+                            stat.highest_modseq = stoull(value);
+                        key_found = false;
+                    }
+                    else
+                    {
+                        key = value;
+                        key_found = true;
+                    }
+                }
+            }
+    }
+    catch (const logic_error& exc)
+    {
+        throw imap_error("Parsing failure.", exc.what());
+    }
+    // The MESSAGES and RECENT are required.
+    if (!mess_found || !recent_found)
+        throw imap_error("No messages or recent messages found.", "");
+    return mailbox;
+}
+
+
 auto imap::parse_tag_result(const string& line) const -> tag_result_response_t
 {
     string::size_type tag_pos = line.find(TOKEN_SEPARATOR_STR);
@@ -1150,14 +2320,38 @@ of the response expression is found by getting the last token of the token seque
 */
 void imap::parse_grammar(const string& imap_string)
 {
-    list<shared_ptr<imap::grammar_token_t>>* token_list;
-    shared_ptr<grammar_token_t> cur_token;
     auto cur_char = imap_string.cbegin();
+    // The literal content is taken straight from the given string, so it is not kept in the response buffer.
+    if (literal_state_ == string_literal_state_t::READING)
+        parse_string_literal(imap_string.cend(), cur_char);
+    if (cur_char == imap_string.cend())
+        return;
+
+    response_buffer_.emplace_back(cur_char, imap_string.cend());
+    const string& line = response_buffer_.back();
+    const size_t tokens_before = tokens_no_;
+    // The atom is extended by writing the char right after its view. The write position never passes the current char, so the escapes of a quoted atom are
+    // removed in place.
+    auto append_atom_char = [this](size_t token, char ch)
+    {
+        string_view& atom = token_arena_[token].atom;
+        string& atom_line = response_buffer_.back();
+        string::size_type atom_end = static_cast<string::size_type>(atom.data() - atom_line.data()) + atom.size();
+        atom_line[atom_end] = ch;
+        atom = string_view(atom_line.data() + atom_end - atom.size(), atom.size() + 1);
+    };
+
+    // The parsing may continue a response of the previous line, so its last token is the current one. Tokens are kept as arena indexes, since adding a
+    // token may move the arena.
+    size_t cur_token = (optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_))->back_index();
+    // The end of line ends an atom, since the quoted string cannot contain the line break.
+    atom_state_ = atom_state_t::NONE;
+    cur_char = line.cbegin();
     do
     {
         if (literal_state_ == string_literal_state_t::READING)
         {
-            parse_string_literal(imap_string.cend(), cur_char);
+            parse_string_literal(line.cend(), cur_char);
             // `cur_char` is incremented in `parse_string_literal()`, so no need to do it here.
             continue;
         }
@@ -1169,7 +2363,7 @@ void imap::parse_grammar(const string& imap_string)
             case OPTIONAL_BEGIN:
             {
                 if (atom_state_ == atom_state_t::QUOTED)
-                    cur_token->atom += *cur_char;
+                    append_atom_char(cur_token, *cur_char);
                 else
                 {
                     if (optional_part_state_)
@@ -1183,7 +2377,7 @@ void imap::parse_grammar(const string& imap_string)
             case OPTIONAL_END:
             {
                 if (atom_state_ == atom_state_t::QUOTED)
-                    cur_token->atom += *cur_char;
+                    append_atom_char(cur_token, *cur_char);
                 else
                 {
                     if (!optional_part_state_)
@@ -1198,13 +2392,11 @@ void imap::parse_grammar(const string& imap_string)
             case LIST_BEGIN:
             {
                 if (atom_state_ == atom_state_t::QUOTED)
-                    cur_token->atom += *cur_char;
+                    append_atom_char(cur_token, *cur_char);
                 else
                 {
-                    cur_token = make_shared<grammar_token_t>();
-                    cur_token->token_type = grammar_token_t::token_type_t::LIST;
-                    token_list = optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_);
-                    token_list->push_back(cur_token);
+                    cur_token = make_token(grammar_token_t::token_type_t::LIST);
+                    (optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_))->push_back(cur_token);
                     parenthesis_list_counter_++;
                     atom_state_ = atom_state_t::NONE;
                 }
@@ -1214,7 +2406,7 @@ void imap::parse_grammar(const string& imap_string)
             case LIST_END:
             {
                 if (atom_state_ == atom_state_t::QUOTED)
-                    cur_token->atom += *cur_char;
+                    append_atom_char(cur_token, *cur_char);
                 else
                 {
                     if (parenthesis_list_counter_ == 0)
@@ -1229,19 +2421,23 @@ void imap::parse_grammar(const string& imap_string)
             case STRING_LITERAL_BEGIN:
             {
                 if (atom_state_ == atom_state_t::QUOTED)
-                    cur_token->atom += *cur_char;
+                    append_atom_char(cur_token, *cur_char);
                 else
-                    parse_string_literal(imap_string.cend(), cur_char);
+                    parse_string_literal(line.cend(), cur_char);
             }
             break;
 
             case TOKEN_SEPARATOR_CHAR:
             {
                 if (atom_state_ == atom_state_t::QUOTED)
-                    cur_token->atom += *cur_char;
-                else if (cur_token != nullptr)
+                    append_atom_char(cur_token, *cur_char);
+                else if (cur_token != token_list_t::NO_TOKEN)
                 {
-                    trim(cur_token->atom);
+                    string_view& atom = token_arena_[cur_token].atom;
+                    while (!atom.empty() && isspace(atom.front()))
+                        atom.remove_prefix(1);
+                    while (!atom.empty() && isspace(atom.back()))
+                        atom.remove_suffix(1);
                     atom_state_ = atom_state_t::NONE;
                 }
             }
@@ -1251,19 +2447,22 @@ void imap::parse_grammar(const string& imap_string)
             {
                 if (atom_state_ == atom_state_t::NONE)
                 {
-                    cur_token = make_shared<grammar_token_t>();
-                    cur_token->token_type = grammar_token_t::token_type_t::ATOM;
-                    token_list = optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_);
-                    token_list->push_back(cur_token);
+                    cur_token = make_token(grammar_token_t::token_type_t::ATOM);
+                    (optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_))->push_back(cur_token);
+                    token_arena_[cur_token].atom = string_view(line.data() + (cur_char - line.cbegin()) + 1, 0);
                     atom_state_ = atom_state_t::QUOTED;
                 }
                 else if (atom_state_ == atom_state_t::QUOTED)
                 {
                     // The backslash and a double quote within an atom is the double quote only.
-                    if (token_list->back()->atom.back() != codec::BACKSLASH_CHAR)
+                    string_view& atom = token_arena_[cur_token].atom;
+                    if (atom.empty() || atom.back() != codec::BACKSLASH_CHAR)
                         atom_state_ = atom_state_t::NONE;
                     else
-                        token_list->back()->atom.back() = *cur_char;
+                    {
+                        atom.remove_suffix(1);
+                        append_atom_char(cur_token, *cur_char);
+                    }
                 }
             }
             break;
@@ -1271,38 +2470,48 @@ void imap::parse_grammar(const string& imap_string)
             default:
             {
                 // Double backslash in an atom is translated to the single backslash.
-                if (*cur_char == codec::BACKSLASH_CHAR && atom_state_ == atom_state_t::QUOTED && token_list->back()->atom.back() == codec::BACKSLASH_CHAR)
+                if (*cur_char == codec::BACKSLASH_CHAR && atom_state_ == atom_state_t::QUOTED && !token_arena_[cur_token].atom.empty() &&
+                    token_arena_[cur_token].atom.back() == codec::BACKSLASH_CHAR)
                     break;
 
                 if (literal_state_ != string_literal_state_t::NONE)
-                    parse_string_literal(imap_string.cend(), cur_char);
+                    parse_string_literal(line.cend(), cur_char);
                 else
                 {
                     if (atom_state_ == atom_state_t::NONE)
                     {
-                        cur_token = make_shared<grammar_token_t>();
-                        cur_token->token_type = grammar_token_t::token_type_t::ATOM;
-                        token_list = optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_);
-                        token_list->push_back(cur_token);
+                        cur_token = make_token(grammar_token_t::token_type_t::ATOM);
+                        (optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_))->push_back(cur_token);
+                        token_arena_[cur_token].atom = string_view(line.data() + (cur_char - line.cbegin()), 0);
                         atom_state_ = atom_state_t::PLAIN;
                     }
-                    cur_token->atom += *cur_char;
+                    append_atom_char(cur_token, *cur_char);
                 }
             }
         }
         cur_char++;
     }
-    while (cur_char != imap_string.cend());
+    while (cur_char != line.cend());
+
+    // No token is viewing the line, like the one closing a list after a literal.
+    if (tokens_no_ == tokens_before)
+        response_buffer_.pop_back();
 }
 
+/*
+The tokens are only marked as unused, so the reset does not depend on the size of the previous response.
+*/
 void imap::reset_grammar_parser()
 {
+    tokens_no_ = 0;
+    response_buffer_.clear();
     optional_part_.clear();
     mandatory_part_.clear();
     optional_part_state_ = false;
     atom_state_ = atom_state_t::NONE;
     parenthesis_list_counter_ = 0;
     literal_state_ = string_literal_state_t::NONE;
+    literal_bytes_read_ = 0;
     eols_no_ = 2;
 }
 
@@ -1340,17 +2549,13 @@ string imap::folder_tree_to_string(const list<string>& folder_tree, string delim
 
 void imap::parse_string_literal(string::const_iterator imap_string_end, string::const_iterator& cur_char)
 {
-    // Number of bytes read so far while parsing a string literal.
-    static string::size_type literal_bytes_read = 0;
-    auto token_list = optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_);
-
     // The string is about to start, parse its length.
     if (literal_state_ == string_literal_state_t::NONE && *cur_char == STRING_LITERAL_BEGIN)
     {
         cur_char++;
-        auto cur_token = make_shared<grammar_token_t>();
-        cur_token->token_type = grammar_token_t::token_type_t::LITERAL;
-        token_list->push_back(cur_token);
+        size_t token_index = make_token(grammar_token_t::token_type_t::LITERAL);
+        (optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_))->push_back(token_index);
+        grammar_token_t& cur_token = token_arena_[token_index];
         atom_state_ = atom_state_t::NONE;
         literal_state_ = string_literal_state_t::READING;
 
@@ -1359,36 +2564,46 @@ void imap::parse_string_literal(string::const_iterator imap_string_end, string::
         {
             if (!isdigit(*cur_char))
                 throw imap_error("Parser failure.", "Non-digit character in the string literal size.");
-            else
-                cur_token->literal_size += *cur_char;
+            string::size_type digit = static_cast<string::size_type>(*cur_char - '0');
+            if (cur_token.literal_size > (cur_token.literal.max_size() - digit) / 10)
+                throw imap_error("Parser failure.", "String literal size overflow.");
+            cur_token.literal_size = cur_token.literal_size * 10 + digit;
             cur_char++;
         }
+        // The literal is read in place, so it is not reallocated while the lines are appended, unless it is larger than the reserve.
+        if (!literal_sink_)
+            cur_token.literal.reserve(cur_token.literal_size < LITERAL_MAX_RESERVE ? cur_token.literal_size : LITERAL_MAX_RESERVE);
     }
     // The literal is being read, it can be spread over multiple lines.
     else if (literal_state_ == string_literal_state_t::READING)
     {
-        auto cur_token = token_list->back();
-        unsigned long literal_size = stoul(cur_token->literal_size);
+        grammar_token_t* cur_token = (optional_part_state_ ? find_last_token_list(optional_part_) : find_last_token_list(mandatory_part_))->back();
+        string::size_type literal_size = cur_token->literal_size;
 
         // Read a line but not exceeding the given string size.
-        while (cur_char != imap_string_end && literal_bytes_read < literal_size)
-        {
-            cur_token->literal += *cur_char;
-            literal_bytes_read++;
-            cur_char++;
-        }
+        string::size_type chunk_len = min(static_cast<string::size_type>(imap_string_end - cur_char),
+            literal_size - literal_bytes_read_);
+        auto chunk_end = cur_char + chunk_len;
+        literal_bytes_read_ += chunk_len;
 
         // Store the string line. If there are more characters after the string literal, they are left for parsing in the `parse_grammar()`.
-        if (literal_bytes_read < literal_size)
+        bool has_eol = literal_bytes_read_ < literal_size;
+        if (has_eol)
+            literal_bytes_read_ += eols_no_;
+        if (literal_sink_)
+            literal_sink_(has_eol ? string(cur_char, chunk_end) + codec::END_OF_LINE : string(cur_char, chunk_end));
+        else
         {
-            cur_token->literal += codec::END_OF_LINE;
-            literal_bytes_read += eols_no_;
+            cur_token->literal.append(cur_char, chunk_end);
+            if (has_eol)
+                cur_token->literal += codec::END_OF_LINE;
         }
+        cur_char = chunk_end;
 
-        if (literal_bytes_read >= literal_size)
+        if (literal_bytes_read_ >= literal_size)
         {
             literal_state_ = string_literal_state_t::NONE;
-            literal_bytes_read = 0;
+            literal_bytes_read_ = 0;
         }
     }
 }
@@ -1406,9 +2621,9 @@ string imap::imap_date_to_string(const boost::gregorian::date& gregorian_date)
 
 
 
-list<shared_ptr<imap::grammar_token_t>>* imap::find_last_token_list(list<shared_ptr<grammar_token_t>>& token_list)
+auto imap::find_last_token_list(token_list_t& token_list) -> token_list_t*
 {
-    list<shared_ptr<grammar_token_t>>* list_ptr = &token_list;
+    token_list_t* list_ptr = &token_list;
     unsigned int depth = 1;
     while (!list_ptr->empty() && list_ptr->back()->token_type == grammar_token_t::token_type_t::LIST && depth <= parenthesis_list_counter_)
     {
@@ -1419,6 +2634,512 @@ list<shared_ptr<imap::grammar_token_t>>* imap::find_last_token_list(list<shared_
 }
 
 
+size_t imap::make_token(grammar_token_t::token_type_t token_type)
+{
+    if (tokens_no_ == token_arena_.size())
+        token_arena_.emplace_back(&token_arena_);
+    grammar_token_t& token = token_arena_[tokens_no_];
+    token.token_type = token_type;
+    token.atom = string_view();
+    if (token.literal.capacity() > TOKEN_LITERAL_MAX_CAPACITY)
+        string().swap(token.literal);
+    else
+        token.literal.clear();
+    token.literal_size = 0;
+    token.parenthesized_list.clear();
+    token.next = token_list_t::NO_TOKEN;
+    return tokens_no_++;
+}
+
+
+string imap::fetch_command(const messages_set_t& messages_range, fetch_options_t options) const
+{
+    if (messages_range.empty())
+        throw imap_error("Empty messages range.", "");
+
+    bool header_only = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::HEADER_ONLY));
+    bool is_uid = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::IS_UID));
+    bool is_flags = (static_cast<uint8_t>(options) & static_cast<uint8_t>(fetch_options_t::FLAGS));
+    const string RFC822_TOKEN = string("RFC822") + (header_only ? ".HEADER" : "");
+    const string message_ids = messages_range.to_string();
+
+    string cmd;
+    if (is_uid)
+        cmd.append("UID ");
+    // TODO: Else branch also to put the RFC822 within parenthesis?
+    if (is_flags)
+        cmd.append("FETCH " + message_ids + TOKEN_SEPARATOR_STR + "(FLAGS " +  RFC822_TOKEN + ")");
+    else
+        cmd.append("FETCH " + message_ids + TOKEN_SEPARATOR_STR + RFC822_TOKEN);
+    return cmd;
+}
+
+
+/*
+According to the RFC 3501 section 7.4.2, the fetch response is the message sequence number followed by the `FETCH` atom and the parenthesized list of
+the message data items, given as pairs of the item name and its value.
+*/
+auto imap::parse_fetch_response() const -> std::optional<fetch_response_t>
+{
+    if (mandatory_part_.size() < 3)
+        return std::nullopt;
+    auto token = mandatory_part_.begin();
+    auto seq_token = *token++;
+    if (!iequals((*token)->atom, "FETCH"))
+        return std::nullopt;
+    auto data_list = *(++token);
+    if (data_list->token_type != grammar_token_t::token_type_t::LIST)
+        return std::nullopt;
+
+    fetch_response_t response;
+    try
+    {
+        response.sequence_no = stoul(string(seq_token->atom));
+    }
+    catch (const logic_error& exc)
+    {
+        throw imap_error("Parsing failure.", exc.what());
+    }
+    for (auto item = data_list->parenthesized_list.begin(); item != data_list->parenthesized_list.end(); item++)
+    {
+        if ((*item)->token_type != grammar_token_t::token_type_t::ATOM)
+            continue;
+        if (iequals((*item)->atom, "UID"))
+        {
+            item++;
+            if (item == data_list->parenthesized_list.end())
+                throw imap_error("No uid number when fetching a message.", "");
+            try
+            {
+                response.uid = stoul(string((*item)->atom));
+            }
+            catch (const logic_error& exc)
+            {
+                throw imap_error("Parsing failure.", exc.what());
+            }
+        }
+        else if (iequals((*item)->atom, "FLAGS"))
+        {
+            item++;
+            if (item == data_list->parenthesized_list.end())
+                break;
+            if ((*item)->token_type == grammar_token_t::token_type_t::LIST)
+                for (const auto& flag : (*item)->parenthesized_list)
+                    response.flags.emplace_back(flag->atom);
+        }
+        else if (iequals((*item)->atom, "MODSEQ"))
+        {
+            item++;
+            if (item == data_list->parenthesized_list.end())
+                break;
+            if ((*item)->token_type == grammar_token_t::token_type_t::LIST && !(*item)->parenthesized_list.empty())
+            {
+                try
+                {
+                    response.modseq = stoull(string((*item)->parenthesized_list.front()->atom));
+                }
+                catch (const logic_error& exc)
+                {
+                    throw imap_error("Parsing failure.", exc.what());
+                }
+            }
+        }
+    }
+    return response;
+}
+
+
+/*
+The server may send unsolicited fetch responses of other messages, so the response is picked by the UID. A missing part is given as `NIL`, which is not
+the same as an empty part.
+*/
+string imap::fetch_body_item(unsigned long uid, const string& item)
+{
+    string content;
+    bool item_found = false;
+    fetch_responses("UID FETCH " + to_string(uid) + TOKEN_SEPARATOR_STR + "(" + item + ")",
+        [uid, &content, &item_found](const fetch_response_t& response, string* literal)
+        {
+            if (response.uid != uid)
+                return;
+
+            item_found = true;
+            if (literal == nullptr)
+                throw imap_error("No message part content.", "UID=`" + to_string(uid) + "`.");
+            content = move(*literal);
+        });
+    if (!item_found)
+        throw imap_error("No message part.", "UID=`" + to_string(uid) + "`, item=`" + item + "`.");
+    return content;
+}
+
+
+auto imap::find_fetch_item(const string& item_name) const -> grammar_token_t*
+{
+    if (mandatory_part_.size() < 3)
+        return nullptr;
+    auto data_list = *std::next(mandatory_part_.begin(), 2);
+    if (data_list->token_type != grammar_token_t::token_type_t::LIST)
+        return nullptr;
+
+    for (auto item = data_list->parenthesized_list.begin(); item != data_list->parenthesized_list.end(); item++)
+        if ((*item)->token_type == grammar_token_t::token_type_t::ATOM && iequals((*item)->atom, item_name))
+        {
+            item++;
+            return item == data_list->parenthesized_list.end() ? nullptr : *item;
+        }
+    return nullptr;
+}
+
+
+/*
+According to the RFC 3501 section 7.4.2, the `BODY[section]<origin>` data item is followed by its content as a literal or as a quoted string. The section
+is not kept apart from the item name by the parser, so the name is matched by its prefix, and it is followed by the origin atom in a partial fetch. The
+`BINARY` data items of the RFC 3516 are the same.
+*/
+auto imap::find_body_item() const -> grammar_token_t*
+{
+    if (mandatory_part_.size() < 3)
+        return nullptr;
+    auto data_list = *std::next(mandatory_part_.begin(), 2);
+    if (data_list->token_type != grammar_token_t::token_type_t::LIST)
+        return nullptr;
+
+    for (auto item = data_list->parenthesized_list.begin(); item != data_list->parenthesized_list.end(); item++)
+    {
+        if ((*item)->token_type != grammar_token_t::token_type_t::ATOM)
+            continue;
+        bool is_section = istarts_with((*item)->atom, "BODY") || istarts_with((*item)->atom, "BINARY");
+        bool is_rfc822 = istarts_with((*item)->atom, "RFC822") && !iequals((*item)->atom, "RFC822.SIZE");
+        if (!is_section && !is_rfc822)
+            continue;
+
+        item++;
+        if (is_section && item != data_list->parenthesized_list.end() && (*item)->token_type == grammar_token_t::token_type_t::ATOM &&
+            istarts_with((*item)->atom, "<"))
+            item++;
+        if (item == data_list->parenthesized_list.end())
+            return nullptr;
+        // The `BODY` without a section and the `BODYSTRUCTURE` are the body structure.
+        if ((*item)->token_type == grammar_token_t::token_type_t::LIST)
+            continue;
+        return *item;
+    }
+    return nullptr;
+}
+
+
+/*
+According to the RFC 3501 section 7.4.2, a multipart body is the list of its parts followed by the subtype and the optional extension data which starts with
+the parameters and the disposition. A single part body is the list of the type, subtype, parameters, id, description, encoding and size. The text part has
+the number of lines added, and the message part has the envelope, the body and the number of lines added. The optional extension data of a single part
+starts with the MD5 and the disposition.
+
+The parts of a multipart are numbered from one within its section. The body of an attached message is numbered as its section if it is multipart,
+otherwise it is the first part of the section. The single part message is the first part as well.
+*/
+void imap::parse_body_structure(const grammar_token_t& body, const string& section, body_part_t& part) const
+{
+    if (body.token_type != grammar_token_t::token_type_t::LIST || body.parenthesized_list.empty())
+        throw imap_error("Parsing failure.", "Body structure is not a list.");
+
+    auto value = [](const grammar_token_t* token)
+    {
+        return token_string(*token);
+    };
+    auto parse_parameters = [&value](const grammar_token_t* token, map<string, string>& parameters)
+    {
+        if (token->token_type != grammar_token_t::token_type_t::LIST)
+            return;
+        for (auto param = token->parenthesized_list.begin(); param != token->parenthesized_list.end(); param++)
+        {
+            string name = to_lower_copy(value(*param));
+            if (++param == token->parenthesized_list.end())
+                break;
+            parameters[name] = value(*param);
+        }
+    };
+    auto parse_disposition = [&value, &parse_parameters, &part](const grammar_token_t* token)
+    {
+        if (token->token_type != grammar_token_t::token_type_t::LIST || token->parenthesized_list.empty())
+            return;
+        part.disposition = to_lower_copy(value(token->parenthesized_list.front()));
+        map<string, string> parameters;
+        if (token->parenthesized_list.size() > 1)
+            parse_parameters(*std::next(token->parenthesized_list.begin()), parameters);
+        auto filename = parameters.find("filename");
+        if (filename != parameters.end())
+            part.filename = filename->second;
+    };
+    auto parse_number = [&value](const grammar_token_t* token)
+    {
+        try
+        {
+            return stoul(value(token));
+        }
+        catch (const logic_error& exc)
+        {
+            throw imap_error("Parsing failure.", exc.what());
+        }
+    };
+
+    vector<grammar_token_t*> fields(body.parenthesized_list.begin(), body.parenthesized_list.end());
+    if (fields.front()->token_type == grammar_token_t::token_type_t::LIST)
+    {
+        part.section = section;
+        part.type = "multipart";
+        vector<grammar_token_t*>::size_type field = 0;
+        for (; field < fields.size() && fields[field]->token_type == grammar_token_t::token_type_t::LIST; field++)
+        {
+            part.parts.emplace_back();
+            parse_body_structure(*fields[field], (section.empty() ? "" : section + ".") + to_string(field + 1), part.parts.back());
+        }
+        if (field < fields.size())
+            part.subtype = to_lower_copy(value(fields[field++]));
+        if (field < fields.size())
+            parse_parameters(fields[field++], part.parameters);
+        if (field < fields.size())
+            parse_disposition(fields[field]);
+        return;
+    }
+
+    if (fields.size() < 7)
+        throw imap_error("Parsing failure.", "Body structure has too few fields.");
+    part.section = section.empty() ? "1" : section;
+    part.type = to_lower_copy(value(fields[0]));
+    part.subtype = to_lower_copy(value(fields[1]));
+    parse_parameters(fields[2], part.parameters);
+    part.encoding = to_lower_copy(value(fields[5]));
+    part.size = parse_number(fields[6]);
+
+    vector<grammar_token_t*>::size_type extension = 7;
+    if (part.type == "text" && fields.size() > 7)
+    {
+        part.lines = parse_number(fields[7]);
+        extension = 8;
+    }
+    else if (part.type == "message" && part.subtype == "rfc822" && fields.size() > 9)
+    {
+        const grammar_token_t& message_body = *fields[8];
+        bool is_multipart = message_body.token_type == grammar_token_t::token_type_t::LIST && !message_body.parenthesized_list.empty() &&
+            message_body.parenthesized_list.front()->token_type == grammar_token_t::token_type_t::LIST;
+        part.parts.emplace_back();
+        parse_body_structure(message_body, is_multipart ? part.section : part.section + ".1", part.parts.back());
+        part.lines = parse_number(fields[9]);
+        extension = 10;
+    }
+    if (fields.size() > extension + 1)
+        parse_disposition(fields[extension + 1]);
+    if (part.filename.empty())
+    {
+        auto name = part.parameters.find("name");
+        if (name != part.parameters.end())
+            part.filename = name->second;
+    }
+}
+
+
+/*
+According to the RFC 3501 section 7.4.2, the envelope is the list of the date, subject, from, sender, reply-to, to, cc, bcc, in-reply-to and message-id
+fields. An address is the list of the name, the source route, the mailbox and the host.
+*/
+void imap::parse_envelope(const grammar_token_t& envelope, message_summary_t& summary) const
+{
+    if (envelope.token_type != grammar_token_t::token_type_t::LIST || envelope.parenthesized_list.size() < 10)
+        throw imap_error("Parsing failure.", "Envelope is not a list of ten fields.");
+
+    vector<grammar_token_t*> fields(envelope.parenthesized_list.begin(), envelope.parenthesized_list.end());
+    summary.date = token_string(*fields[0]);
+    summary.subject = token_string(*fields[1]);
+    summary.message_id = token_string(*fields[9]);
+    if (fields[2]->token_type == grammar_token_t::token_type_t::LIST)
+        for (auto address : fields[2]->parenthesized_list)
+        {
+            if (address->token_type != grammar_token_t::token_type_t::LIST || address->parenthesized_list.size() < 4)
+                continue;
+            vector<grammar_token_t*> parts(address->parenthesized_list.begin(), address->parenthesized_list.end());
+            string mailbox = token_string(*parts[2]);
+            string host = token_string(*parts[3]);
+            summary.from.push_back(mail_address(string_t(token_string(*parts[0])), host.empty() ? mailbox : mailbox + codec::MONKEY_CHAR + host));
+        }
+}
+
+
+/*
+The fields are unfolded, and the first occurrence of a field is kept.
+*/
+void imap::parse_header_fields(const string& header, map<string, string>& fields)
+{
+    string name;
+    string value;
+    auto store = [&fields, &name, &value]()
+    {
+        if (!name.empty())
+            fields.emplace(to_lower_copy(name), trim_copy(value));
+        name.clear();
+        value.clear();
+    };
+
+    string::size_type line_begin = 0;
+    while (line_begin < header.length())
+    {
+        string::size_type line_end = header.find(codec::END_OF_LINE, line_begin);
+        if (line_end == string::npos)
+            line_end = header.length();
+        string line = header.substr(line_begin, line_end - line_begin);
+        line_begin = line_end + codec::END_OF_LINE.length();
+
+        if (!line.empty() && (line[0] == codec::SPACE_CHAR || line[0] == codec::TAB_CHAR))
+            value += line;
+        else
+        {
+            store();
+            string::size_type colon = line.find(codec::COLON_CHAR);
+            if (colon != string::npos)
+            {
+                name = trim_copy(line.substr(0, colon));
+                value = line.substr(colon + 1);
+            }
+        }
+    }
+    store();
+}
+
+
+string imap::token_string(const grammar_token_t& token)
+{
+    if (token.token_type == grammar_token_t::token_type_t::LITERAL)
+        return token.literal;
+    if (token.token_type == grammar_token_t::token_type_t::ATOM && !iequals(token.atom, "NIL"))
+        return string(token.atom);
+    return string();
+}
+
+
+void imap::store_capabilities(const token_list_t& tokens)
+{
+    if (tokens.empty() || tokens.front()->token_type != grammar_token_t::token_type_t::ATOM || !iequals(tokens.front()->atom, "CAPABILITY"))
+        return;
+
+    capabilities_ = vector<string>();
+    for (auto token = std::next(tokens.begin()); token != tokens.end(); token++)
+        if ((*token)->token_type == grammar_token_t::token_type_t::ATOM)
+            capabilities_->emplace_back((*token)->atom);
+}
+
+
+imap::token_list_t::iterator::iterator(vector<grammar_token_t>* arena, size_t index) : arena_(arena), index_(index)
+{
+}
+
+
+auto imap::token_list_t::iterator::operator*() const -> grammar_token_t*
+{
+    return &(*arena_)[index_];
+}
+
+
+auto imap::token_list_t::iterator::operator++() -> iterator&
+{
+    index_ = (*arena_)[index_].next;
+    return *this;
+}
+
+
+auto imap::token_list_t::iterator::operator++(int) -> iterator
+{
+    iterator it = *this;
+    ++(*this);
+    return it;
+}
+
+
+bool imap::token_list_t::iterator::operator==(const iterator& other) const
+{
+    return index_ == other.index_;
+}
+
+
+bool imap::token_list_t::iterator::operator!=(const iterator& other) const
+{
+    return index_ != other.index_;
+}
+
+
+imap::token_list_t::token_list_t(vector<grammar_token_t>* arena) : arena_(arena), head_(NO_TOKEN), tail_(NO_TOKEN), size_(0)
+{
+}
+
+
+auto imap::token_list_t::begin() const -> iterator
+{
+    return iterator(arena_, head_);
+}
+
+
+auto imap::token_list_t::end() const -> iterator
+{
+    return iterator(arena_, NO_TOKEN);
+}
+
+
+auto imap::token_list_t::front() const -> grammar_token_t*
+{
+    return &(*arena_)[head_];
+}
+
+
+auto imap::token_list_t::back() const -> grammar_token_t*
+{
+    return &(*arena_)[tail_];
+}
+
+
+size_t imap::token_list_t::back_index() const
+{
+    return tail_;
+}
+
+
+bool imap::token_list_t::empty() const
+{
+    return size_ == 0;
+}
+
+
+size_t imap::token_list_t::size() const
+{
+    return size_;
+}
+
+
+void imap::token_list_t::push_back(size_t index)
+{
+    if (size_ == 0)
+        head_ = index;
+    else
+        (*arena_)[tail_].next = index;
+    tail_ = index;
+    size_++;
+}
+
+
+void imap::token_list_t::pop_front()
+{
+    head_ = (*arena_)[head_].next;
+    if (--size_ == 0)
+        tail_ = NO_TOKEN;
+}
+
+
+void imap::token_list_t::clear()
+{
+    head_ = NO_TOKEN;
+    tail_ = NO_TOKEN;
+    size_ = 0;
+}
+
+
 imaps::imaps(const string& hostname, unsigned port, milliseconds timeout) : imap(hostname, port, timeout)
 {
     ssl_options_ =
@@ -1443,6 +3164,16 @@ string imaps::authenticate(const string& username, const string& password, auth_
         is_start_tls_ = true;
         greeting = imap::authenticate(username, password, imap::auth_method_t::LOGIN);
     }
+    else if (method == auth_method_t::PLAIN || method == auth_method_t::START_TLS_PLAIN)
+    {
+        is_start_tls_ = (method == auth_method_t::START_TLS_PLAIN);
+        greeting = imap::authenticate(username, password, imap::auth_method_t::PLAIN);
+    }
+    else if (method == auth_method_t::XOAUTH2 || method == auth_method_t::START_TLS_XOAUTH2)
+    {
+        is_start_tls_ = (method == auth_method_t::START_TLS_XOAUTH2);
+        greeting = imap::authenticate(username, password, imap::auth_method_t::XOAUTH2);
+    }
     return greeting;
 }
 
@@ -0,0 +1,390 @@
+/*
+
+mailbox_cache.cpp
+-----------------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <mailio/codec.hpp>
+#include <mailio/mailboxes.hpp>
+#include <mailio/imap.hpp>
+#include <mailio/mailbox_cache.hpp>
+
+
+using std::getline;
+using std::ifstream;
+using std::istream;
+using std::logic_error;
+using std::max;
+using std::move;
+using std::ofstream;
+using std::ostream;
+using std::stoul;
+using std::stoull;
+using std::string;
+using std::to_string;
+using std::vector;
+
+
+namespace mailio
+{
+
+
+const string mailbox_cache::INDEX_TAG{"mailio-index 1"};
+
+
+mailbox_cache::mailbox_cache(const string& mailbox, const string& index_path, const string& store_path, const vector<string>& header_fields) :
+    mailbox_(mailbox), index_path_(index_path), store_path_(store_path), header_fields_(header_fields), uid_validity_(0), uid_next_(0),
+    highest_modseq_(0)
+{
+    ifstream input(index_path_, std::ios::binary);
+    if (input)
+        load(input);
+}
+
+
+/*
+The flags are fetched before the new messages, so the known messages are compared against the same state of the mailbox as the number of messages given
+by the examine command. Without the modification sequences, fetching the flags of all known messages also finds the removed ones. With them, only the
+changed flags are fetched, so the removed messages are looked up by the search only if the number of messages does not match.
+
+The server returns the last message for the range starting after it, so the fetched summaries are filtered by the known next UID.
+*/
+auto mailbox_cache::synchronize(imap& connection) -> sync_result_t
+{
+    imap::mailbox_stat_t stat = connection.select(mailbox_, true);
+    if (stat.uid_validity == 0)
+        throw mailbox_cache_error("No UID validity.", "Mailbox=`" + mailbox_ + "`.");
+
+    sync_result_t result;
+    if (stat.uid_validity != uid_validity_)
+    {
+        result.is_reset = uid_validity_ != 0;
+        vector<unsigned long> uids;
+        for (const auto& msg : messages_)
+            uids.push_back(msg.first);
+        remove(uids);
+        uid_validity_ = stat.uid_validity;
+        uid_next_ = 0;
+        highest_modseq_ = 0;
+    }
+
+    bool is_removed_found = false;
+    imap::messages_set_t known_uids;
+    for (const auto& msg : messages_)
+        known_uids.insert(msg.first);
+    if (!known_uids.empty())
+    {
+        auto update_flags = [this, &result](const imap::fetch_response_t& response)
+        {
+            auto msg = messages_.find(response.uid);
+            if (msg != messages_.end() && msg->second.flags != response.flags)
+            {
+                msg->second.flags = response.flags;
+                result.changed.push_back(response.uid);
+            }
+        };
+
+        if (highest_modseq_ != 0 && stat.highest_modseq != 0)
+        {
+            if (stat.highest_modseq != highest_modseq_)
+                for (const auto& response : connection.fetch_changes(known_uids, highest_modseq_).changed)
+                    update_flags(response);
+        }
+        else
+        {
+            std::map<unsigned long, imap::fetch_response_t> responses = connection.fetch_flags(known_uids, true);
+            for (const auto& msg : messages_)
+                if (responses.find(msg.first) == responses.end())
+                    result.removed.push_back(msg.first);
+            remove(result.removed);
+            for (const auto& response : responses)
+                update_flags(response.second);
+            is_removed_found = true;
+        }
+    }
+
+    if (stat.messages_no > 0 && (stat.uid_next == 0 || stat.uid_next > uid_next_))
+    {
+        const unsigned long first_uid = max(uid_next_, 1UL);
+        std::map<unsigned long, imap::message_summary_t> summaries = connection.fetch_summaries({imap::messages_range_t(first_uid, std::nullopt)}, true,
+            header_fields_);
+        for (auto& summary : summaries)
+        {
+            if (summary.first < first_uid || messages_.find(summary.first) != messages_.end())
+                continue;
+            if (!store_path_.empty())
+                download(connection, summary.first);
+            messages_[summary.first] = move(summary.second);
+            result.added.push_back(summary.first);
+        }
+    }
+
+    if (!is_removed_found && messages_.size() != stat.messages_no)
+    {
+        imap::search_result_t found = connection.search({imap::search_condition_t(imap::search_condition_t::ALL)}, imap::search_result_t::ALL, true);
+        const imap::messages_set_t removed_uids = known_uids - found.all;
+        const vector<unsigned long> removed(removed_uids.begin(), removed_uids.end());
+        remove(removed);
+        result.removed.insert(result.removed.end(), removed.begin(), removed.end());
+    }
+
+    uid_next_ = max(uid_next_, stat.uid_next);
+    if (!messages_.empty())
+        uid_next_ = max(uid_next_, messages_.rbegin()->first + 1);
+    highest_modseq_ = stat.highest_modseq;
+    save();
+    return result;
+}
+
+
+/*
+The renaming does not replace an existing file on some platforms, so the old index is removed first in that case.
+*/
+void mailbox_cache::save() const
+{
+    const string temp_path = index_path_ + ".tmp";
+    {
+        ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+        if (!output)
+            throw mailbox_cache_error("Writing index failure.", "Path=`" + temp_path + "`.");
+        store(output);
+        output.close();
+        if (!output)
+            throw mailbox_cache_error("Writing index failure.", "Path=`" + temp_path + "`.");
+    }
+    if (std::rename(temp_path.c_str(), index_path_.c_str()) != 0)
+    {
+        std::remove(index_path_.c_str());
+        if (std::rename(temp_path.c_str(), index_path_.c_str()) != 0)
+            throw mailbox_cache_error("Writing index failure.", "Path=`" + index_path_ + "`.");
+    }
+}
+
+
+auto mailbox_cache::messages() const -> const messages_t&
+{
+    return messages_;
+}
+
+
+unsigned long mailbox_cache::uid_validity() const
+{
+    return uid_validity_;
+}
+
+
+unsigned long mailbox_cache::uid_next() const
+{
+    return uid_next_;
+}
+
+
+unsigned long long mailbox_cache::highest_modseq() const
+{
+    return highest_modseq_;
+}
+
+
+string mailbox_cache::message_path(unsigned long uid) const
+{
+    if (store_path_.empty())
+        return "";
+    return store_path_ + "/" + to_string(uid) + ".eml";
+}
+
+
+/*
+The index is a line per value, given by the key and the value separated by the space. Each message starts with its UID, followed by its attributes. The
+addresses and the header fields are given by two values separated by the tab, which is escaped within the values.
+*/
+void mailbox_cache::load(istream& input)
+{
+    string line;
+    if (!getline(input, line) || line != INDEX_TAG)
+        throw mailbox_cache_error("Parsing index failure.", "Path=`" + index_path_ + "`.");
+
+    imap::message_summary_t* summary = nullptr;
+    try
+    {
+        while (getline(input, line))
+        {
+            if (line.empty())
+                continue;
+            string::size_type key_pos = line.find(' ');
+            if (key_pos == string::npos)
+                throw mailbox_cache_error("Parsing index failure.", "Line=`" + line + "`.");
+            const string key = line.substr(0, key_pos);
+            const string value = line.substr(key_pos + 1);
+            const string::size_type pair_pos = value.find('\t');
+
+            if (key == "uidvalidity")
+                uid_validity_ = stoul(value);
+            else if (key == "uidnext")
+                uid_next_ = stoul(value);
+            else if (key == "highestmodseq")
+                highest_modseq_ = stoull(value);
+            else if (key == "message")
+            {
+                const unsigned long uid = stoul(value);
+                summary = &messages_[uid];
+                summary->uid = uid;
+            }
+            else if (summary == nullptr)
+                throw mailbox_cache_error("Parsing index failure.", "Line=`" + line + "`.");
+            else if (key == "size")
+                summary->size = stoul(value);
+            else if (key == "flag")
+                summary->flags.push_back(unescape(value));
+            else if (key == "date")
+                summary->date = unescape(value);
+            else if (key == "subject")
+                summary->subject = unescape(value);
+            else if (key == "message-id")
+                summary->message_id = unescape(value);
+            else if (key == "from" && pair_pos != string::npos)
+                summary->from.push_back(mail_address(string_t(unescape(value.substr(0, pair_pos))), unescape(value.substr(pair_pos + 1))));
+            else if (key == "field" && pair_pos != string::npos)
+                summary->header_fields[unescape(value.substr(0, pair_pos))] = unescape(value.substr(pair_pos + 1));
+            else
+                throw mailbox_cache_error("Parsing index failure.", "Line=`" + line + "`.");
+        }
+    }
+    catch (const logic_error& exc)
+    {
+        throw mailbox_cache_error("Parsing index failure.", exc.what());
+    }
+}
+
+
+void mailbox_cache::store(ostream& output) const
+{
+    output << INDEX_TAG << '\n';
+    output << "uidvalidity " << uid_validity_ << '\n';
+    output << "uidnext " << uid_next_ << '\n';
+    output << "highestmodseq " << highest_modseq_ << '\n';
+    for (const auto& msg : messages_)
+    {
+        const imap::message_summary_t& summary = msg.second;
+        output << "message " << msg.first << '\n';
+        output << "size " << summary.size << '\n';
+        for (const auto& flag : summary.flags)
+            output << "flag " << escape(flag) << '\n';
+        output << "date " << escape(summary.date) << '\n';
+        output << "subject " << escape(summary.subject) << '\n';
+        output << "message-id " << escape(summary.message_id) << '\n';
+        for (const auto& address : summary.from)
+            output << "from " << escape(address.name.buffer) << '\t' << escape(address.address) << '\n';
+        for (const auto& field : summary.header_fields)
+            output << "field " << escape(field.first) << '\t' << escape(field.second) << '\n';
+    }
+}
+
+
+string mailbox_cache::escape(const string& value)
+{
+    string escaped;
+    escaped.reserve(value.length());
+    for (auto ch : value)
+        switch (ch)
+        {
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            default:
+                escaped += ch;
+        }
+    return escaped;
+}
+
+
+string mailbox_cache::unescape(const string& value)
+{
+    string unescaped;
+    unescaped.reserve(value.length());
+    for (string::size_type i = 0; i < value.length(); i++)
+    {
+        if (value[i] != '\\' || i + 1 == value.length())
+        {
+            unescaped += value[i];
+            continue;
+        }
+        switch (value[++i])
+        {
+            case 't':
+                unescaped += '\t';
+                break;
+            case 'r':
+                unescaped += '\r';
+                break;
+            case 'n':
+                unescaped += '\n';
+                break;
+            default:
+                unescaped += value[i];
+        }
+    }
+    return unescaped;
+}
+
+
+void mailbox_cache::remove(const vector<unsigned long>& uids)
+{
+    for (auto uid : uids)
+    {
+        messages_.erase(uid);
+        if (!store_path_.empty())
+            std::remove(message_path(uid).c_str());
+    }
+}
+
+
+void mailbox_cache::download(imap& connection, unsigned long uid) const
+{
+    const string path = message_path(uid);
+    ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output)
+        throw mailbox_cache_error("Writing message failure.", "Path=`" + path + "`.");
+    connection.download(uid, [&output](unsigned long, const string& chunk)
+        {
+            output.write(chunk.data(), chunk.length());
+        });
+    output.close();
+    if (!output)
+        throw mailbox_cache_error("Writing message failure.", "Path=`" + path + "`.");
+}
+
+
+mailbox_cache_error::mailbox_cache_error(const string& msg, const string& details) : imap_error(msg, details)
+{
+}
+
+
+mailbox_cache_error::mailbox_cache_error(const char* msg, const string& details) : imap_error(msg, details)
+{
+}
+
+
+} // namespace mailio
@@ -46,6 +46,7 @@ using std::list;
 using std::multimap;
 using std::pair;
 using std::make_pair;
+using std::move;
 using std::locale;
 using std::ios_base;
 using std::istream;
@@ -103,37 +104,50 @@ message::message() : mime(), date_time_(second_clock::universal_time(), time_zon
 
 void message::format(string& message_str, const message_format_options_t& opts) const
 {
-    message_str += format_header(opts.add_bcc_header);
+    format([&message_str](const string& chunk) { message_str += chunk; }, opts);
+}
+
+
+void message::format(const format_sink_t& sink, const message_format_options_t& opts) const
+{
+    sink(format_header(opts.add_bcc_header));
 
     if (!parts_.empty())
     {
         if (!content_.empty())
         {
-            mime content_part;
-            content_part.content(content_);
-            content_type_t ct(media_type_t::TEXT, "plain", content_type_.charset());
-            content_part.content_type(ct);
-            content_part.content_transfer_encoding(encoding_);
-            content_part.line_policy(line_policy_);
-            content_part.strict_mode(strict_mode_);
-            content_part.strict_codec_mode(strict_codec_mode_);
-            string cps;
-            content_part.format(cps, opts.dot_escape);
-            message_str += BOUNDARY_DELIMITER + content_type_.boundary() + codec::END_OF_LINE + cps + codec::END_OF_LINE;
+            sink(BOUNDARY_DELIMITER + content_type_.boundary() + codec::END_OF_LINE);
+            make_content_part().format(sink, opts.dot_escape);
+            sink(codec::END_OF_LINE);
         }
 
         // Recursively format mime parts.
 
         for (const auto& p: parts_)
         {
-            string p_str;
-            p.format(p_str, opts.dot_escape);
-            message_str += BOUNDARY_DELIMITER + content_type_.boundary() + codec::END_OF_LINE + p_str + codec::END_OF_LINE;
+            sink(BOUNDARY_DELIMITER + content_type_.boundary() + codec::END_OF_LINE);
+            p.format(sink, opts.dot_escape);
+            sink(codec::END_OF_LINE);
         }
-        message_str += BOUNDARY_DELIMITER + content_type_.boundary() + BOUNDARY_DELIMITER + codec::END_OF_LINE;
+        sink(BOUNDARY_DELIMITER + content_type_.boundary() + BOUNDARY_DELIMITER + codec::END_OF_LINE);
     }
     else
-        message_str += format_content(opts.dot_escape);
+        format_content(sink, opts.dot_escape);
+}
+
+
+string::size_type message::formatted_size(const message_format_options_t& opts) const
+{
+    string::size_type size = format_header(opts.add_bcc_header).length();
+    if (parts_.empty())
+        return size + formatted_content_size(opts.dot_escape);
+
+    const string::size_type delimiter_size = BOUNDARY_DELIMITER.length() + content_type_.boundary().length() + codec::END_OF_LINE.length();
+    if (!content_.empty())
+        size += delimiter_size + make_content_part().formatted_size(opts.dot_escape) + codec::END_OF_LINE.length();
+    for (const auto& p: parts_)
+        size += delimiter_size + p.formatted_size(opts.dot_escape) + codec::END_OF_LINE.length();
+    return size + delimiter_size + BOUNDARY_DELIMITER.length();
 }
 
 
@@ -603,6 +617,20 @@ string message::format_header(bool add_bcc_header) const
 }
 
 
+mime message::make_content_part() const
+{
+    mime content_part;
+    content_part.content(content_);
+    content_type_t ct(media_type_t::TEXT, "plain", content_type_.charset());
+    content_part.content_type(ct);
+    content_part.content_transfer_encoding(encoding_);
+    content_part.line_policy(line_policy_);
+    content_part.strict_mode(strict_mode_);
+    content_part.strict_codec_mode(strict_codec_mode_);
+    return content_part;
+}
+
+
 /*
 TODO: parsing address list does not check the line policy
 TODO: other headers should check for the line policy as well?
@@ -1559,4 +1587,118 @@ vector<string> message::split_qc_string(const string& text)
 }
 
 
+formatted_message::formatted_message(const message& msg, bool add_bcc_header) :
+    content_(format_content(msg, add_bcc_header)), size_(unescaped_size(content_)), envelope_(make_envelope(msg))
+{
+}
+
+
+formatted_message::formatted_message(string content, envelope_t envelope) :
+    content_(move(content)), size_(unescaped_size(content_)), envelope_(move(envelope))
+{
+}
+
+
+const string& formatted_message::content() const
+{
+    return content_;
+}
+
+
+string::size_type formatted_message::size() const
+{
+    return size_;
+}
+
+
+const string& formatted_message::sender() const
+{
+    return envelope_.sender;
+}
+
+
+const vector<string>& formatted_message::recipients() const
+{
+    return envelope_.recipients;
+}
+
+
+auto formatted_message::envelope() const -> const envelope_t&
+{
+    return envelope_;
+}
+
+
+auto formatted_message::make_envelope(const message& msg) -> envelope_t
+{
+    envelope_t envelope;
+    envelope.sender = envelope_sender(msg);
+    for (auto& rcpt : envelope_recipient_kinds(msg))
+    {
+        envelope.recipients.push_back(move(rcpt.first));
+        envelope.recipient_kinds.push_back(rcpt.second);
+    }
+    return envelope;
+}
+
+
+string formatted_message::format_content(const message& msg, bool add_bcc_header)
+{
+    string msg_str;
+    msg.format(msg_str, message_format_options_t{true, add_bcc_header});
+    return msg_str;
+}
+
+
+/*
+Each line beginning with a dot has it escaped, as required by [rfc 5321, section 4.5.2].
+*/
+string::size_type formatted_message::unescaped_size(const string& content)
+{
+    string::size_type size = content.length();
+    if (!content.empty() && content[0] == codec::DOT_CHAR)
+        size--;
+    for (string::size_type pos = content.find(codec::END_OF_LINE); pos != string::npos; pos = content.find(codec::END_OF_LINE, pos + 1))
+        if (pos + codec::END_OF_LINE.length() < content.length() && content[pos + codec::END_OF_LINE.length()] == codec::DOT_CHAR)
+            size--;
+    return size;
+}
+
+
+string formatted_message::envelope_sender(const message& msg)
+{
+    if (!msg.sender().address.empty())
+        return msg.sender().address;
+    if (!msg.from().addresses.empty())
+        return msg.from().addresses.front().address;
+    return "";
+}
+
+
+vector<string> formatted_message::envelope_recipients(const message& msg)
+{
+    vector<string> rcpts;
+    for (auto& rcpt : envelope_recipient_kinds(msg))
+        rcpts.push_back(move(rcpt.first));
+    return rcpts;
+}
+
+
+vector<pair<string, formatted_message::recipient_kind_t>> formatted_message::envelope_recipient_kinds(const message& msg)
+{
+    vector<pair<string, recipient_kind_t>> rcpts;
+    auto add_mailboxes = [&rcpts](const mailboxes& mbxs, recipient_kind_t address_kind, recipient_kind_t group_kind)
+    {
+        for (const auto& rcpt : mbxs.addresses)
+            rcpts.push_back(make_pair(rcpt.address, address_kind));
+        for (const auto& rcpt : mbxs.groups)
+            rcpts.push_back(make_pair(rcpt.name, group_kind));
+    };
+    add_mailboxes(msg.recipients(), recipient_kind_t::RECIPIENT, recipient_kind_t::GROUP_RECIPIENT);
+    add_mailboxes(msg.cc_recipients(), recipient_kind_t::CC_RECIPIENT, recipient_kind_t::GROUP_CC_RECIPIENT);
+    add_mailboxes(msg.bcc_recipients(), recipient_kind_t::BCC_RECIPIENT, recipient_kind_t::GROUP_BCC_RECIPIENT);
+    return rcpts;
+}
+
+
 } // namespace mailio
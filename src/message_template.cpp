@@ -0,0 +1,270 @@
+/*
+
+message_template.cpp
+--------------------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <mailio/codec.hpp>
+#include <mailio/mime.hpp>
+#include <mailio/message.hpp>
+#include <mailio/message_template.hpp>
+
+
+using std::string;
+using std::vector;
+using std::move;
+
+
+namespace mailio
+{
+
+
+message_template::message_template(const message& msg, const string& field_begin, const string& field_end) :
+    field_begin_(field_begin), field_end_(field_end), header_(msg)
+{
+    if (field_begin_.empty() || field_end_.empty())
+        throw mime_error("Empty field delimiter.", "");
+    header_.cc_recipients_.clear();
+    header_.bcc_recipients_.clear();
+
+    if (header_.parts_.empty())
+    {
+        if (!has_placeholder(header_.content_))
+            content_ = header_.format_content(true);
+        else if ((split_content_ = split_content(header_)).has_value())
+            header_.content_.clear();
+        return;
+    }
+
+    if (!header_.content_.empty())
+    {
+        segments_.push_back(make_segment(header_.make_content_part()));
+        header_.content_.clear();
+    }
+    for (const auto& p : header_.parts_)
+        segments_.push_back(make_segment(p));
+
+    // The header depends only on the presence of parts, so a single empty part is kept instead of copying all of them on each rendering.
+    header_.parts_.assign(1, mime());
+}
+
+
+formatted_message message_template::render(const mailboxes& recipients, const fields_t& fields) const
+{
+    message msg = header_;
+    msg.recipients_ = recipients;
+    msg.subject_.buffer = substitute(header_.subject_.buffer, fields);
+    string msg_str = msg.format_header(false);
+
+    if (segments_.empty())
+    {
+        if (content_.has_value())
+            msg_str += *content_;
+        else if (split_content_.has_value())
+            render_content(header_, *split_content_, fields, msg_str);
+        else
+        {
+            msg.content_ = substitute(header_.content_, fields);
+            msg_str += msg.format_content(true);
+        }
+    }
+    else
+    {
+        const string boundary = header_.content_type_.boundary();
+        for (const auto& segment : segments_)
+        {
+            msg_str += mime::BOUNDARY_DELIMITER + boundary + codec::END_OF_LINE;
+            msg_str += segment.formatted;
+            if (segment.content.has_value())
+                render_content(*segment.part, *segment.content, fields, msg_str);
+            else if (segment.part.has_value())
+            {
+                mime part = *segment.part;
+                substitute(part, fields);
+                part.format(msg_str, true);
+            }
+            msg_str += codec::END_OF_LINE;
+        }
+        msg_str += mime::BOUNDARY_DELIMITER + boundary + mime::BOUNDARY_DELIMITER + codec::END_OF_LINE;
+    }
+
+    return formatted_message(move(msg_str), formatted_message::make_envelope(msg));
+}
+
+
+/*
+A part without subparts is formatted as its header followed by the content, so the header is formatted once and only the content is split.
+*/
+auto message_template::make_segment(const mime& part) const -> segment_t
+{
+    segment_t segment;
+    if (!has_placeholder(part))
+        part.format(segment.formatted, true);
+    else if (part.parts_.empty() && part.content_type_.boundary().empty() && (segment.content = split_content(part)).has_value())
+    {
+        segment.formatted = part.format_header() + codec::END_OF_LINE;
+        segment.part = part;
+        segment.part->content_.clear();
+    }
+    else
+        segment.part = part;
+    return segment;
+}
+
+
+/*
+The lines with placeholders span from the line of the placeholder begin to the line of its end, so a placeholder folded over several lines is kept whole.
+A placeholder beginning on the lines already taken extends them.
+*/
+auto message_template::split_content(const mime& part) const -> std::optional<content_t>
+{
+    if (part.encoding_ == mime::content_transfer_encoding_t::BASE_64 || part.encoding_ == mime::content_transfer_encoding_t::BINARY)
+        return std::nullopt;
+
+    const string& text = part.content_;
+    content_t content;
+    string::size_type static_begin = 0;
+    string::size_type begin_pos = text.find(field_begin_);
+    while (begin_pos != string::npos)
+    {
+        string::size_type end_pos = text.find(field_end_, begin_pos + field_begin_.length());
+        if (end_pos == string::npos)
+            break;
+        end_pos += field_end_.length();
+        string::size_type line_end = text.find(codec::END_OF_LINE, end_pos);
+        line_end = (line_end == string::npos) ? text.length() : line_end + codec::END_OF_LINE.length();
+
+        if (begin_pos < static_begin)
+        {
+            if (line_end > static_begin)
+                content.texts.back().append(text, static_begin, line_end - static_begin);
+        }
+        else
+        {
+            string::size_type line_begin = text.rfind(codec::END_OF_LINE, begin_pos);
+            line_begin = (line_begin == string::npos || line_begin < static_begin) ? static_begin : line_begin + codec::END_OF_LINE.length();
+            content.formatted.push_back(format_lines(part, text.substr(static_begin, line_begin - static_begin)));
+            content.texts.push_back(text.substr(line_begin, line_end - line_begin));
+        }
+        static_begin = std::max(static_begin, line_end);
+        begin_pos = text.find(field_begin_, end_pos);
+    }
+    content.formatted.push_back(format_lines(part, text.substr(static_begin)));
+    return content;
+}
+
+
+/*
+The trailing empty lines are removed from the whole content, as the codecs do.
+*/
+void message_template::render_content(const mime& encoder, const content_t& content, const fields_t& fields, string& msg_str) const
+{
+    const string::size_type content_begin = msg_str.length();
+    msg_str += content.formatted.front();
+    for (vector<string>::size_type i = 0; i < content.texts.size(); i++)
+    {
+        msg_str += format_lines(encoder, substitute(content.texts[i], fields));
+        msg_str += content.formatted[i + 1];
+    }
+
+    const string::size_type eol_len = codec::END_OF_LINE.length();
+    while (msg_str.length() >= content_begin + eol_len && msg_str.compare(msg_str.length() - eol_len, eol_len, codec::END_OF_LINE) == 0 &&
+        (msg_str.length() == content_begin + eol_len || msg_str.compare(msg_str.length() - 2 * eol_len, eol_len, codec::END_OF_LINE) == 0))
+        msg_str.resize(msg_str.length() - eol_len);
+}
+
+
+/*
+The codecs remove the trailing empty lines of the encoded text, while the lines followed by more content keep them. So, a sentinel line is encoded after
+the text and dropped, and the trailing empty lines are removed only at the end of the whole content.
+*/
+string message_template::format_lines(const mime& encoder, const string& text)
+{
+    if (text.empty())
+        return "";
+
+    const string SENTINEL_LINE = "x";
+    string sentinel_text = text;
+    if (sentinel_text.length() < codec::END_OF_LINE.length() ||
+        sentinel_text.compare(sentinel_text.length() - codec::END_OF_LINE.length(), codec::END_OF_LINE.length(), codec::END_OF_LINE) != 0)
+        sentinel_text += codec::END_OF_LINE;
+    sentinel_text += SENTINEL_LINE;
+    vector<string> lines = encoder.encode_content(sentinel_text);
+    lines.pop_back();
+
+    string formatted;
+    for (const auto& line : lines)
+    {
+        if (!line.empty() && line[0] == codec::DOT_CHAR)
+            formatted += codec::DOT_CHAR;
+        formatted += line + codec::END_OF_LINE;
+    }
+    return formatted;
+}
+
+
+bool message_template::has_placeholder(const string& text) const
+{
+    return text.find(field_begin_) != string::npos;
+}
+
+
+bool message_template::has_placeholder(const mime& part) const
+{
+    if (has_placeholder(part.content_))
+        return true;
+    for (const auto& p : part.parts_)
+        if (has_placeholder(p))
+            return true;
+    return false;
+}
+
+
+string message_template::substitute(const string& text, const fields_t& fields) const
+{
+    string result;
+    string::size_type pos = 0;
+    string::size_type begin_pos = text.find(field_begin_);
+    while (begin_pos != string::npos)
+    {
+        string::size_type name_pos = begin_pos + field_begin_.length();
+        string::size_type end_pos = text.find(field_end_, name_pos);
+        if (end_pos == string::npos)
+            break;
+
+        string name = text.substr(name_pos, end_pos - name_pos);
+        auto field = fields.find(name);
+        if (field == fields.end())
+            throw mime_error("Missing template field.", "Field=`" + name + "`.");
+        result.append(text, pos, begin_pos - pos);
+        result += field->second;
+        pos = end_pos + field_end_.length();
+        begin_pos = text.find(field_begin_, pos);
+    }
+    result.append(text, pos, string::npos);
+    return result;
+}
+
+
+void message_template::substitute(mime& part, const fields_t& fields) const
+{
+    part.content_ = substitute(part.content_, fields);
+    for (auto& p : part.parts_)
+        substitute(p, fields);
+}
+
+
+} // namespace mailio
@@ -205,29 +205,70 @@ mime::mime() : version_("1.0"), line_policy_(codec::line_len_policy_t::MANDATORY
 
 
 void mime::format(string& mime_str, bool dot_escape) const
+{
+    format([&mime_str](const string& chunk) { mime_str += chunk; }, dot_escape);
+}
+
+
+void mime::format(const format_sink_t& sink, bool dot_escape) const
 {
     if (!content_type_.boundary().empty() && content_type_.media_type() != media_type_t::MULTIPART)
         throw mime_error("Formatting failure, non multipart message with boundary.", "");
 
-    mime_str += format_header() + codec::END_OF_LINE;
+    sink(format_header() + codec::END_OF_LINE);
+    if (parts_.empty())
+    {
+        format_content(sink, dot_escape);
+        return;
+    }
+
     string content = format_content(dot_escape);
-    mime_str += content;
+    sink(content);
+    if (!content.empty())
+        sink(codec::END_OF_LINE);
 
-    if (!parts_.empty())
+    // Recursively format mime parts.
+
+    for (auto& p : parts_)
     {
-        if (!content.empty())
-            mime_str += codec::END_OF_LINE;
+        sink(BOUNDARY_DELIMITER + content_type_.boundary() + codec::END_OF_LINE);
+        p.format(sink, dot_escape);
+        sink(codec::END_OF_LINE);
+    }
+    sink(BOUNDARY_DELIMITER + content_type_.boundary() + BOUNDARY_DELIMITER + codec::END_OF_LINE);
+}
 
-        // Recursively format mime parts.
 
-        for (auto& p : parts_)
-        {
-            string p_str;
-            p.format(p_str, dot_escape);
-            mime_str += BOUNDARY_DELIMITER + content_type_.boundary() + codec::END_OF_LINE + p_str + codec::END_OF_LINE;
-        }
-        mime_str += BOUNDARY_DELIMITER + content_type_.boundary() + BOUNDARY_DELIMITER + codec::END_OF_LINE;
-    }
+string::size_type mime::formatted_size(bool dot_escape) const
+{
+    if (!content_type_.boundary().empty() && content_type_.media_type() != media_type_t::MULTIPART)
+        throw mime_error("Formatting failure, non multipart message with boundary.", "");
+
+    string::size_type size = format_header().length() + codec::END_OF_LINE.length();
+    if (parts_.empty())
+        return size + formatted_content_size(dot_escape);
+
+    string::size_type content_size = formatted_content_size(dot_escape);
+    size += content_size;
+    if (content_size > 0)
+        size += codec::END_OF_LINE.length();
+
+    const string::size_type delimiter_size = BOUNDARY_DELIMITER.length() + content_type_.boundary().length();
+    for (auto& p : parts_)
+        size += delimiter_size + codec::END_OF_LINE.length() + p.formatted_size(dot_escape) + codec::END_OF_LINE.length();
+    return size + delimiter_size + BOUNDARY_DELIMITER.length() + codec::END_OF_LINE.length();
+}
+
+
+bool mime::formatted_size_computable() const
+{
+    const string::size_type line_octets = static_cast<string::size_type>(line_policy_) / 4 * 3;
+    if (!content_.empty() && (encoding_ != content_transfer_encoding_t::BASE_64 || line_policy_ == codec::line_len_policy_t::NONE || line_octets == 0))
+        return false;
+    for (const auto& p : parts_)
+        if (!p.formatted_size_computable())
+            return false;
+    return true;
 }
 
 
@@ -566,6 +607,20 @@ string mime::format_header() const
 
 
 string mime::format_content(bool dot_escape) const
+{
+    vector<string> content_lines = encode_content(content_);
+    string content;
+    for (const auto& s : content_lines)
+        if (dot_escape && s[0] == codec::DOT_CHAR)
+            content += string(1, codec::DOT_CHAR) + s + codec::END_OF_LINE;
+        else
+            content += s + codec::END_OF_LINE;
+
+    return content;
+}
+
+
+vector<string> mime::encode_content(const string& text) const
 {
     vector<string> content_lines;
     switch (encoding_)
@@ -574,7 +629,7 @@ string mime::format_content(bool dot_escape) const
         {
             base64 b(static_cast<string::size_type>(line_policy_), static_cast<string::size_type>(line_policy_));
             b.strict_mode(strict_codec_mode_);
-            content_lines = b.encode(content_);
+            content_lines = b.encode(text);
             break;
         }
 
@@ -582,7 +637,7 @@ string mime::format_content(bool dot_escape) const
         {
             quoted_printable qp(static_cast<string::size_type>(line_policy_), static_cast<string::size_type>(line_policy_));
             qp.strict_mode(strict_codec_mode_);
-            content_lines = qp.encode(content_);
+            content_lines = qp.encode(text);
             break;
         }
 
@@ -591,7 +646,16 @@ string mime::format_content(bool dot_escape) const
         {
             bit8 b8(static_cast<string::size_type>(line_policy_), static_cast<string::size_type>(line_policy_));
             b8.strict_mode(strict_codec_mode_);
-            content_lines = b8.encode(content_);
+            content_lines = b8.encode(text);
+            break;
+        }
+
+        case content_transfer_encoding_t::BINARY:
+        {
+            // TODO: probably bug when `\0` is part of the content
+            binary b(static_cast<string::size_type>(line_policy_), static_cast<string::size_type>(line_policy_));
+            b.strict_mode(strict_codec_mode_);
+            content_lines = b.encode(text);
             break;
         }
 
@@ -601,30 +665,60 @@ string mime::format_content(bool dot_escape) const
         {
             bit7 b7(static_cast<string::size_type>(line_policy_), static_cast<string::size_type>(line_policy_));
             b7.strict_mode(strict_codec_mode_);
-            content_lines = b7.encode(content_);
-            break;
-        }
-
-        case content_transfer_encoding_t::BINARY:
-        {
-            // TODO: probably bug when `\0` is part of the content
-            binary b(static_cast<string::size_type>(line_policy_), static_cast<string::size_type>(line_policy_));
-            b.strict_mode(strict_codec_mode_);
-            content_lines = b.encode(content_);
+            content_lines = b7.encode(text);
             break;
         }
 
         // default encoding is seven bit, so no `default` clause
     }
+    return content_lines;
+}
 
-    string content;
-    for (const auto& s : content_lines)
-        if (dot_escape && s[0] == codec::DOT_CHAR)
-            content += string(1, codec::DOT_CHAR) + s + codec::END_OF_LINE;
-        else
-            content += s + codec::END_OF_LINE;
 
-    return content;
+/*
+Base64 lines of the same length always encode the same number of octets, so encoding the content slice by slice, where each slice is made of whole
+lines, gives the same lines as encoding it at once. Base64 lines never begin with a dot, so no escaping is needed.
+*/
+void mime::format_content(const format_sink_t& sink, bool dot_escape) const
+{
+    const string::size_type policy = static_cast<string::size_type>(line_policy_);
+    const string::size_type line_octets = policy / 4 * 3;
+    if (encoding_ != content_transfer_encoding_t::BASE_64 || line_policy_ == codec::line_len_policy_t::NONE || line_octets == 0 ||
+        content_.length() <= FORMAT_SLICE_LEN)
+    {
+        sink(format_content(dot_escape));
+        return;
+    }
+
+    base64 b(policy, policy);
+    b.strict_mode(strict_codec_mode_);
+    const string::size_type slice_len = (FORMAT_SLICE_LEN / line_octets > 0 ? FORMAT_SLICE_LEN / line_octets : 1) * line_octets;
+    for (string::size_type pos = 0; pos < content_.length(); pos += slice_len)
+    {
+        string content;
+        for (const auto& line : b.encode(content_.substr(pos, slice_len)))
+            content += line + codec::END_OF_LINE;
+        sink(content);
+    }
+}
+
+
+/*
+All Base64 lines but the last one encode the same number of octets, and the last one is padded to the multiple of four characters.
+*/
+string::size_type mime::formatted_content_size(bool dot_escape) const
+{
+    const string::size_type policy = static_cast<string::size_type>(line_policy_);
+    const string::size_type line_octets = policy / 4 * 3;
+    if (encoding_ != content_transfer_encoding_t::BASE_64 || line_policy_ == codec::line_len_policy_t::NONE || line_octets == 0)
+        return format_content(dot_escape).length();
+
+    const string::size_type full_lines = content_.length() / line_octets;
+    const string::size_type last_octets = content_.length() % line_octets;
+    string::size_type size = full_lines * (policy / 4 * 4 + codec::END_OF_LINE.length());
+    if (last_octets > 0)
+        size += (last_octets + 2) / 3 * 4 + codec::END_OF_LINE.length();
+    return size;
 }
 
 
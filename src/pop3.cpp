@@ -12,13 +12,20 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 
 #include <string>
 #include <vector>
+#include <list>
 #include <map>
+#include <deque>
+#include <future>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <utility>
 #include <algorithm>
 #include <chrono>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <mailio/pop3.hpp>
 
 
@@ -27,6 +34,8 @@ using std::string;
 using std::to_string;
 using std::vector;
 using std::map;
+using std::future;
+using std::packaged_task;
 using std::runtime_error;
 using std::out_of_range;
 using std::invalid_argument;
@@ -39,6 +48,8 @@ using std::make_tuple;
 using std::move;
 using std::make_shared;
 using std::chrono::milliseconds;
+using boost::asio::post;
+using boost::asio::thread_pool;
 using boost::algorithm::trim;
 using boost::iequals;
 
@@ -48,7 +59,7 @@ namespace mailio
 
 
 pop3::pop3(const string& hostname, unsigned port, milliseconds timeout) :
-    dlg_(make_shared<dialog>(hostname, port, timeout)), is_start_tls_(true)
+    dlg_(make_shared<dialog>(hostname, port, timeout)), is_start_tls_(true), parser_threads_(0)
 {
     ssl_options_ =
         {
@@ -243,56 +254,52 @@ auto pop3::statistics() -> mailbox_stat_t
 
 void pop3::fetch(unsigned long message_no, message& msg, bool header_only)
 {
-    string line;
-    if (header_only)
-    {
-        dlg_->send("TOP " + to_string(message_no) + " 0");
-        line = dlg_->receive();
-        tuple<string, string> stat_msg = parse_status(line);
-        if (iequals(std::get<0>(stat_msg), "-ERR"))
-            return;
-    }
-    else
+    if (request_message(message_no, header_only))
+        receive_message(header_only, msg);
+}
+
+
+/*
+With the parser threads, at most two messages per thread are kept as the received lines, so the retrieving waits for the parsing instead of buffering
+the whole mailbox.
+*/
+map<unsigned long, message> pop3::fetch(const std::list<unsigned long>& messages, bool header_only)
+{
+    map<unsigned long, message> found_messages;
+    if (parser_threads_ == 0)
     {
-        dlg_->send("RETR " + to_string(message_no));
-        line = dlg_->receive();
-        tuple<string, string> stat_msg = parse_status(line);
-        if (iequals(std::get<0>(stat_msg), "-ERR"))
-            throw pop3_error("Fetching message failure.", std::get<1>(stat_msg));
+        for (auto message_no : messages)
+            if (request_message(message_no, header_only))
+                receive_message(header_only, found_messages[message_no]);
+        return found_messages;
     }
 
-    // end of message is marked with crlf+dot+crlf sequence
-    // empty_line marks the last empty line, so it could be used to detect end of message when dot is reached
-    bool empty_line = false;
-    while (true)
+    // The pool is destroyed after the parsed messages, so the parsing tasks own all their data.
+    thread_pool pool(parser_threads_);
+    const std::size_t max_parsing = 2 * static_cast<std::size_t>(parser_threads_);
+    std::deque<pair<unsigned long, future<message>>> parsing_messages;
+    for (auto message_no : messages)
     {
-        line = dlg_->receive();
-        // reading line by line ensures that crlf are the last characters read; so, reaching single dot in the line means that it's end of message
-        if (line == codec::END_OF_MESSAGE)
-        {
-            // if header only, then mark the header end with the empty line
-            if (header_only)
-                msg.parse_by_line("");
-            msg.parse_by_line(codec::END_OF_LINE);
-            break;
-        }
-        else if (line.empty())
-        {
-            // ensure that sequence of empty lines are all included in the message; otherwise, mark that an empty line is reached
-            if (empty_line)
-                msg.parse_by_line("");
-            else
-                empty_line = true;
-        }
-        else
+        if (!request_message(message_no, header_only))
+            continue;
+
+        auto task = make_shared<packaged_task<message()>>([lines = receive_lines(), header_only]()
+            {
+                message msg;
+                parse_message(lines, header_only, msg);
+                return msg;
+            });
+        parsing_messages.emplace_back(message_no, task->get_future());
+        post(pool, [task]() { (*task)(); });
+        if (parsing_messages.size() == max_parsing)
         {
-            // regular line with the content; if empty line was before this one, ensure that it is included
-            if (empty_line)
-                msg.parse_by_line("");
-            msg.parse_by_line(line, true);
-            empty_line = false;
+            found_messages.insert_or_assign(parsing_messages.front().first, parsing_messages.front().second.get());
+            parsing_messages.pop_front();
         }
     }
+    for (auto& pm : parsing_messages)
+        found_messages.insert_or_assign(pm.first, pm.second.get());
+    return found_messages;
 }
 
 
@@ -318,6 +325,12 @@ void pop3::ssl_options(const std::optional<dialog_ssl::ssl_options_t> options)
 }
 
 
+void pop3::parser_threads(unsigned threads)
+{
+    parser_threads_ = threads;
+}
+
+
 string pop3::connect()
 {
     string line = dlg_->receive();
@@ -363,6 +376,87 @@ void pop3::switch_tls()
 }
 
 
+bool pop3::request_message(unsigned long message_no, bool header_only)
+{
+    if (header_only)
+    {
+        dlg_->send("TOP " + to_string(message_no) + " 0");
+        string line = dlg_->receive();
+        tuple<string, string> stat_msg = parse_status(line);
+        if (iequals(std::get<0>(stat_msg), "-ERR"))
+            return false;
+    }
+    else
+    {
+        dlg_->send("RETR " + to_string(message_no));
+        string line = dlg_->receive();
+        tuple<string, string> stat_msg = parse_status(line);
+        if (iequals(std::get<0>(stat_msg), "-ERR"))
+            throw pop3_error("Fetching message failure.", std::get<1>(stat_msg));
+    }
+    return true;
+}
+
+
+void pop3::receive_message(bool header_only, message& msg)
+{
+    // empty_line marks the last empty line, so it could be used to detect end of message when dot is reached
+    bool empty_line = false;
+    // reading line by line ensures that crlf are the last characters read; so, reaching single dot in the line means that it's end of message
+    for (string line = dlg_->receive(); line != codec::END_OF_MESSAGE; line = dlg_->receive())
+        parse_line(line, empty_line, msg);
+    parse_end(header_only, msg);
+}
+
+
+vector<string> pop3::receive_lines()
+{
+    vector<string> lines;
+    for (string line = dlg_->receive(); line != codec::END_OF_MESSAGE; line = dlg_->receive())
+        lines.push_back(move(line));
+    return lines;
+}
+
+
+void pop3::parse_message(const vector<string>& lines, bool header_only, message& msg)
+{
+    bool empty_line = false;
+    for (const auto& line : lines)
+        parse_line(line, empty_line, msg);
+    parse_end(header_only, msg);
+}
+
+
+void pop3::parse_line(const string& line, bool& empty_line, message& msg)
+{
+    if (line.empty())
+    {
+        // ensure that sequence of empty lines are all included in the message; otherwise, mark that an empty line is reached
+        if (empty_line)
+            msg.parse_by_line("");
+        else
+            empty_line = true;
+    }
+    else
+    {
+        // regular line with the content; if empty line was before this one, ensure that it is included
+        if (empty_line)
+            msg.parse_by_line("");
+        msg.parse_by_line(line, true);
+        empty_line = false;
+    }
+}
+
+
+void pop3::parse_end(bool header_only, message& msg)
+{
+    // if header only, then mark the header end with the empty line
+    if (header_only)
+        msg.parse_by_line("");
+    msg.parse_by_line(codec::END_OF_LINE);
+}
+
+
 tuple<string, string> pop3::parse_status(const string& line)
 {
     string::size_type pos = line.find(TOKEN_SEPARATOR_CHAR);
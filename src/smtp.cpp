@@ -17,6 +17,11 @@ copy at http://www.freebsd.org/copyright/freebsd-license.html.
 #include <tuple>
 #include <algorithm>
 #include <boost/asio/ip/host_name.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <mailio/base64.hpp>
 #include <mailio/smtp.hpp>
 
@@ -27,7 +32,10 @@ using std::vector;
 using std::string;
 using std::to_string;
 using std::tuple;
+using std::min;
+using std::any_of;
 using std::stoi;
+using std::stoull;
 using std::move;
 using std::make_shared;
 using std::runtime_error;
@@ -36,6 +44,12 @@ using std::invalid_argument;
 using std::chrono::milliseconds;
 using boost::asio::ip::host_name;
 using boost::system::system_error;
+using boost::iequals;
+using boost::split;
+using boost::to_upper_copy;
+using boost::trim_copy;
+using boost::token_compress_on;
+using boost::algorithm::is_any_of;
 
 
 namespace mailio
@@ -84,89 +98,40 @@ string smtp::authenticate(const string& username, const string& password, auth_m
         ;
     else if (method == auth_method_t::LOGIN)
         auth_login(username, password);
+    else if (method == auth_method_t::PLAIN)
+    {
+        if (!auth_advertised("PLAIN") && auth_advertised("LOGIN"))
+            auth_login(username, password);
+        else
+            auth_plain(username, password);
+    }
+    else if (method == auth_method_t::XOAUTH2)
+        auth_xoauth2(username, password);
     return greeting;
 }
 
 
 string smtp::submit(const message& msg)
 {
-    if (!msg.sender().address.empty())
-        dlg_->send("MAIL FROM: " + message::ADDRESS_BEGIN_STR + msg.sender().address + message::ADDRESS_END_STR);
-    else
-        dlg_->send("MAIL FROM: " + message::ADDRESS_BEGIN_STR + msg.from().addresses.at(0).address + message::ADDRESS_END_STR);
-    string line = dlg_->receive();
-    tuple<int, bool, string> tokens = parse_line(line);
-    if (std::get<1>(tokens) && !positive_completion(std::get<0>(tokens)))
-        throw smtp_error("Mail sender rejection.", std::get<2>(tokens));
-
-    for (const auto& rcpt : msg.recipients().addresses)
-    {
-        dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + rcpt.address + message::ADDRESS_END_STR);
-        line = dlg_->receive();
-        tokens = parse_line(line);
-        if (!positive_completion(std::get<0>(tokens)))
-            throw smtp_error("Mail recipient rejection.", std::get<2>(tokens));
-    }
-
-    for (const auto& rcpt : msg.recipients().groups)
-    {
-        dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + rcpt.name + message::ADDRESS_END_STR);
-        line = dlg_->receive();
-        tokens = parse_line(line);
-        if (!positive_completion(std::get<0>(tokens)))
-            throw smtp_error("Mail group recipient rejection.", std::get<2>(tokens));
-    }
+    return transaction(formatted_message::make_envelope(msg), declared_size(msg), [this, &msg]() { data(msg); });
+}
 
-    for (const auto& rcpt : msg.cc_recipients().addresses)
-    {
-        dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + rcpt.address + message::ADDRESS_END_STR);
-        line = dlg_->receive();
-        tokens = parse_line(line);
-        if (!positive_completion(std::get<0>(tokens)))
-            throw smtp_error("Mail cc recipient rejection.", std::get<2>(tokens));
-    }
 
-    for (const auto& rcpt : msg.cc_recipients().groups)
-    {
-        dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + rcpt.name + message::ADDRESS_END_STR);
-        line = dlg_->receive();
-        tokens = parse_line(line);
-        if (!positive_completion(std::get<0>(tokens)))
-            throw smtp_error("Mail group cc recipient rejection.", std::get<2>(tokens));
-    }
+string smtp::submit(const formatted_message& msg)
+{
+    return transaction(msg.envelope(), msg.size(), [this, &msg]() { data(msg); });
+}
 
-    for (const auto& rcpt : msg.bcc_recipients().addresses)
-    {
-        dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + rcpt.address + message::ADDRESS_END_STR);
-        line = dlg_->receive();
-        tokens = parse_line(line);
-        if (!positive_completion(std::get<0>(tokens)))
-            throw smtp_error("Mail bcc recipient rejection.", std::get<2>(tokens));
-    }
 
-    for (const auto& rcpt : msg.bcc_recipients().groups)
-    {
-        dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + rcpt.name + message::ADDRESS_END_STR);
-        line = dlg_->receive();
-        tokens = parse_line(line);
-        if (!positive_completion(std::get<0>(tokens)))
-            throw smtp_error("Mail group bcc recipient rejection.", std::get<2>(tokens));
-    }
+smtp::submit_report_t smtp::submit_partial(const message& msg)
+{
+    return partial_transaction(formatted_message::make_envelope(msg), declared_size(msg), [this, &msg]() { data(msg); });
+}
 
-    dlg_->send("DATA");
-    line = dlg_->receive();
-    tokens = parse_line(line);
-    if (!positive_intermediate(std::get<0>(tokens)))
-        throw smtp_error("Mail message rejection.", std::get<2>(tokens));
 
-    string msg_str;
-    msg.format(msg_str, {/*dot_escape*/true});
-    dlg_->send(msg_str + codec::END_OF_LINE + codec::END_OF_MESSAGE);
-    line = dlg_->receive();
-    tokens = parse_line(line);
-    if (!positive_completion(std::get<0>(tokens)))
-        throw smtp_error("Mail message rejection.", std::get<2>(tokens));
-    return std::get<2>(tokens);
+smtp::submit_report_t smtp::submit_partial(const formatted_message& msg)
+{
+    return partial_transaction(msg.envelope(), msg.size(), [this, &msg]() { data(msg); });
 }
 
 
@@ -220,19 +185,13 @@ void smtp::auth_login(const string& username, const string& password)
     if (std::get<1>(tokens) && !positive_intermediate(std::get<0>(tokens)))
         throw smtp_error("Authentication rejection.", std::get<2>(tokens));
 
-    // TODO: Use static encode from the Base64 codec.
-    base64 b64(static_cast<string::size_type>(codec::line_len_policy_t::MANDATORY), static_cast<string::size_type>(codec::line_len_policy_t::MANDATORY));
-    auto user_v = b64.encode(username);
-    string cmd = user_v.empty() ? "" : user_v[0];
-    dlg_->send(cmd);
+    dlg_->send(base64::encode_line(username));
     line = dlg_->receive();
     tokens = parse_line(line);
     if (std::get<1>(tokens) && !positive_intermediate(std::get<0>(tokens)))
         throw smtp_error("Username rejection.", std::get<2>(tokens));
 
-    auto pass_v = b64.encode(password);
-    cmd = pass_v.empty() ? "" : pass_v[0];
-    dlg_->send(cmd);
+    dlg_->send(base64::encode_line(password));
     line = dlg_->receive();
     tokens = parse_line(line);
     if (std::get<1>(tokens) && !positive_completion(std::get<0>(tokens)))
@@ -240,22 +199,65 @@ void smtp::auth_login(const string& username, const string& password)
 }
 
 
-void smtp::ehlo()
+void smtp::auth_plain(const string& username, const string& password)
+{
+    // No authorization identity is given, so the server derives it from the username.
+    auth_initial_response("PLAIN", string(1, codec::NIL_CHAR) + username + string(1, codec::NIL_CHAR) + password);
+}
+
+
+void smtp::auth_xoauth2(const string& username, const string& access_token)
+{
+    const string SOH(1, '\x01');
+    auth_initial_response("XOAUTH2", "user=" + username + SOH + "auth=Bearer " + access_token + SOH + SOH);
+}
+
+
+void smtp::auth_initial_response(const string& mechanism, const string& initial_response)
 {
-    dlg_->send("EHLO " + src_host_);
+    dlg_->send("AUTH " + mechanism + codec::SPACE_STR + base64::encode_line(initial_response));
     string line = dlg_->receive();
     tuple<int, bool, string> tokens = parse_line(line);
+    if (positive_intermediate(std::get<0>(tokens)))
+    {
+        dlg_->send("");
+        line = dlg_->receive();
+        tokens = parse_line(line);
+    }
     while (!std::get<1>(tokens))
     {
         line = dlg_->receive();
         tokens = parse_line(line);
     }
+    if (!positive_completion(std::get<0>(tokens)))
+        throw smtp_error("Authentication rejection.", std::get<2>(tokens));
+}
+
+
+bool smtp::auth_advertised(const string& mechanism) const
+{
+    auto auth = extensions_.find("AUTH");
+    if (auth == extensions_.end())
+        return false;
+
+    vector<string> mechanisms;
+    split(mechanisms, auth->second, is_any_of(codec::SPACE_STR), token_compress_on);
+    return any_of(mechanisms.begin(), mechanisms.end(), [&mechanism](const string& m) { return iequals(m, mechanism); });
+}
+
 
+/*
+The first line of the reply is the server greeting, each of the others is a service extension keyword optionally followed by parameters, as defined by
+the RFC 5321 section 4.1.1.1.
+*/
+void smtp::ehlo()
+{
+    tuple<int, bool, string> tokens = hello("EHLO");
     if (!positive_completion(std::get<0>(tokens)))
     {
         dlg_->send("HELO " + src_host_);
 
-        line = dlg_->receive();
+        string line = dlg_->receive();
         tokens = parse_line(line);
         while (!std::get<1>(tokens))
         {
@@ -268,6 +270,246 @@ void smtp::ehlo()
 }
 
 
+tuple<int, bool, string> smtp::hello(const string& command)
+{
+    dlg_->send(command + codec::SPACE_STR + src_host_);
+    extensions_.clear();
+    string line = dlg_->receive();
+    tuple<int, bool, string> tokens = parse_line(line);
+    while (!std::get<1>(tokens))
+    {
+        line = dlg_->receive();
+        tokens = parse_line(line);
+        add_extension(std::get<2>(tokens));
+    }
+    return tokens;
+}
+
+
+void smtp::add_extension(const string& ext_line)
+{
+    string::size_type sep_pos = ext_line.find_first_of(" =");
+    string keyword = to_upper_copy(ext_line.substr(0, sep_pos));
+    extensions_[keyword] = (sep_pos == string::npos) ? "" : trim_copy(ext_line.substr(sep_pos + 1));
+}
+
+
+/*
+According to the RFC 1870 section 4, the `SIZE` keyword is optionally followed by the maximum message size accepted by the server, where zero means no
+fixed limit.
+*/
+void smtp::mail_from(const string& address, string::size_type size)
+{
+    string command = "MAIL FROM: " + message::ADDRESS_BEGIN_STR + address + message::ADDRESS_END_STR;
+    auto size_ext = extensions_.find("SIZE");
+    if (size_ext != extensions_.end() && size > 0)
+    {
+        string::size_type limit = 0;
+        try
+        {
+            limit = size_ext->second.empty() ? 0 : stoull(size_ext->second);
+        }
+        catch (const std::invalid_argument&)
+        {
+            // Malformed limit is not enforced, the server decides on the declared size.
+        }
+        catch (const std::out_of_range&)
+        {
+        }
+        if (limit > 0 && size > limit)
+            throw smtp_error("Message size exceeding the server limit.", "Size=" + to_string(size) + ", limit=" + to_string(limit) + ".");
+        command += " SIZE=" + to_string(size);
+    }
+
+    dlg_->send(command);
+    string line = dlg_->receive();
+    tuple<int, bool, string> tokens = parse_line(line);
+    if (std::get<1>(tokens) && !positive_completion(std::get<0>(tokens)))
+        throw smtp_error("Mail sender rejection.", std::get<2>(tokens));
+}
+
+
+/*
+The size excludes the escaped leading dots as required by [rfc 1870, section 3].
+*/
+string::size_type smtp::declared_size(const message& msg) const
+{
+    if (extensions_.find("SIZE") == extensions_.end() || !msg.formatted_size_computable())
+        return 0;
+    return msg.formatted_size(message_format_options_t{false, false});
+}
+
+
+tuple<int, bool, string> smtp::rcpt_to(const string& address)
+{
+    dlg_->send("RCPT TO: " + message::ADDRESS_BEGIN_STR + address + message::ADDRESS_END_STR);
+    string line = dlg_->receive();
+    return parse_line(line);
+}
+
+
+vector<smtp::recipient_status_t> smtp::envelope(const string& sender, const vector<string>& recipients, string::size_type size)
+{
+    mail_from(sender, size);
+
+    vector<recipient_status_t> statuses;
+    for (const auto& rcpt : recipients)
+    {
+        tuple<int, bool, string> tokens = rcpt_to(rcpt);
+        statuses.push_back(recipient_status_t{rcpt, std::get<0>(tokens), std::get<2>(tokens)});
+    }
+
+    if (!any_accepted(statuses))
+        reset();
+    return statuses;
+}
+
+
+bool smtp::any_accepted(const vector<recipient_status_t>& recipients)
+{
+    return any_of(recipients.begin(), recipients.end(), [](const recipient_status_t& rs) { return rs.accepted(); });
+}
+
+
+string smtp::transaction(const formatted_message::envelope_t& envelope, string::size_type size, const data_writer_t& data_writer)
+{
+    mail_from(envelope.sender, size);
+    for (vector<string>::size_type i = 0; i < envelope.recipients.size(); i++)
+    {
+        tuple<int, bool, string> tokens = rcpt_to(envelope.recipients[i]);
+        if (!positive_completion(std::get<0>(tokens)))
+            throw smtp_error(recipient_rejection(envelope.recipient_kinds[i]), std::get<2>(tokens));
+    }
+
+    data_writer();
+    string line = dlg_->receive();
+    tuple<int, bool, string> tokens = parse_line(line);
+    if (!positive_completion(std::get<0>(tokens)))
+        throw smtp_error("Mail message rejection.", std::get<2>(tokens));
+    return std::get<2>(tokens);
+}
+
+
+auto smtp::partial_transaction(const formatted_message::envelope_t& envelope, string::size_type size, const data_writer_t& data_writer) -> submit_report_t
+{
+    submit_report_t report;
+    report.recipients = this->envelope(envelope.sender, envelope.recipients, size);
+    if (!any_accepted(report.recipients))
+        return report;
+
+    data_writer();
+    string line = dlg_->receive();
+    tuple<int, bool, string> tokens = parse_line(line);
+    report.status = std::get<0>(tokens);
+    report.response = std::get<2>(tokens);
+    return report;
+}
+
+
+void smtp::start_data()
+{
+    dlg_->send("DATA");
+    string line = dlg_->receive();
+    tuple<int, bool, string> tokens = parse_line(line);
+    if (!positive_intermediate(std::get<0>(tokens)))
+        throw smtp_error("Mail message rejection.", std::get<2>(tokens));
+}
+
+
+void smtp::data(const formatted_message& msg)
+{
+    start_data();
+    // The content is sent apart from the end of message mark, so it is not copied on each transaction.
+    dlg_->send_raw(msg.content());
+    dlg_->send_raw(codec::END_OF_LINE + codec::END_OF_MESSAGE + codec::END_OF_LINE);
+}
+
+
+/*
+The leading dots are escaped by the writer rather than by the formatter, keeping track of the line beginnings across the formatted chunks. The `DATA`
+command is issued when the first chunk is written, so a message whose header fails to format leaves the transaction open, and it is reset.
+*/
+void smtp::data(const message& msg)
+{
+    string chunk;
+    bool line_begin = true;
+    bool data_started = false;
+    auto flush = [this, &chunk, &data_started]()
+    {
+        if (!data_started)
+        {
+            data_started = true;
+            start_data();
+        }
+        dlg_->send_raw(chunk);
+        chunk.clear();
+    };
+    auto writer = [&chunk, &line_begin, &flush](const string& text)
+    {
+        string::size_type pos = 0;
+        while (pos < text.length())
+        {
+            if (line_begin && text[pos] == codec::DOT_CHAR)
+                chunk += codec::DOT_CHAR;
+            string::size_type line_end = text.find(codec::LF_CHAR, pos);
+            string::size_type end = (line_end == string::npos) ? text.length() : line_end + 1;
+            while (pos < end)
+            {
+                if (chunk.length() >= DATA_CHUNK_LEN)
+                    flush();
+                string::size_type len = min(end - pos, DATA_CHUNK_LEN - chunk.length());
+                chunk.append(text, pos, len);
+                pos += len;
+            }
+            line_begin = (line_end != string::npos);
+        }
+    };
+
+    try
+    {
+        msg.format(writer, message_format_options_t{false, false});
+    }
+    catch (...)
+    {
+        if (!data_started)
+            reset();
+        throw;
+    }
+    chunk += codec::END_OF_LINE + codec::END_OF_MESSAGE + codec::END_OF_LINE;
+    flush();
+}
+
+
+void smtp::reset()
+{
+    dlg_->send("RSET");
+    string line = dlg_->receive();
+    tuple<int, bool, string> tokens = parse_line(line);
+    if (!positive_completion(std::get<0>(tokens)))
+        throw smtp_error("Mail transaction reset failure.", std::get<2>(tokens));
+}
+
+
+string smtp::recipient_rejection(formatted_message::recipient_kind_t kind)
+{
+    switch (kind)
+    {
+        case formatted_message::recipient_kind_t::GROUP_RECIPIENT:
+            return "Mail group recipient rejection.";
+        case formatted_message::recipient_kind_t::CC_RECIPIENT:
+            return "Mail cc recipient rejection.";
+        case formatted_message::recipient_kind_t::GROUP_CC_RECIPIENT:
+            return "Mail group cc recipient rejection.";
+        case formatted_message::recipient_kind_t::BCC_RECIPIENT:
+            return "Mail bcc recipient rejection.";
+        case formatted_message::recipient_kind_t::GROUP_BCC_RECIPIENT:
+            return "Mail group bcc recipient rejection.";
+        default:
+            return "Mail recipient rejection.";
+    }
+}
+
+
 string smtp::read_hostname()
 {
     try
@@ -334,6 +576,18 @@ inline bool smtp::permanent_negative(int status)
 }
 
 
+bool smtp::recipient_status_t::accepted() const
+{
+    return positive_completion(status);
+}
+
+
+bool smtp::submit_report_t::accepted() const
+{
+    return positive_completion(status);
+}
+
+
 smtps::smtps(const string& hostname, unsigned port, milliseconds timeout) :
     smtp(hostname, port, timeout)
 {
@@ -364,6 +618,16 @@ string smtps::authenticate(const string& username, const string& password, auth_
         is_start_tls_ = true;
         greeting = smtp::authenticate(username, password, smtp::auth_method_t::LOGIN);
     }
+    else if (method == auth_method_t::PLAIN || method == auth_method_t::START_TLS_PLAIN)
+    {
+        is_start_tls_ = (method == auth_method_t::START_TLS_PLAIN);
+        greeting = smtp::authenticate(username, password, smtp::auth_method_t::PLAIN);
+    }
+    else if (method == auth_method_t::XOAUTH2 || method == auth_method_t::START_TLS_XOAUTH2)
+    {
+        is_start_tls_ = (method == auth_method_t::START_TLS_XOAUTH2);
+        greeting = smtp::authenticate(username, password, smtp::auth_method_t::XOAUTH2);
+    }
     return greeting;
 }
 
@@ -374,6 +638,69 @@ void smtps::ssl_options(const dialog_ssl::ssl_options_t& options)
 }
 
 
+lmtp::lmtp(const string& hostname, unsigned port, milliseconds timeout) : smtp(hostname, port, timeout)
+{
+}
+
+
+vector<smtp::recipient_status_t> lmtp::submit(const message& msg)
+{
+    return deliver(formatted_message::make_envelope(msg), declared_size(msg), [this, &msg]() { data(msg); });
+}
+
+
+vector<smtp::recipient_status_t> lmtp::submit(const formatted_message& msg)
+{
+    return deliver(msg.envelope(), msg.size(), [this, &msg]() { data(msg); });
+}
+
+
+/*
+If no recipient is accepted, the server has to reject the `DATA` command, so the transaction is reset instead.
+*/
+auto lmtp::deliver(const formatted_message::envelope_t& envelope, string::size_type size, const data_writer_t& data_writer) -> vector<recipient_status_t>
+{
+    vector<recipient_status_t> statuses = this->envelope(envelope.sender, envelope.recipients, size);
+    if (!any_accepted(statuses))
+        return statuses;
+
+    data_writer();
+    delivery_statuses(statuses);
+    return statuses;
+}
+
+
+/*
+According to the RFC 2033 section 4.2, after the final dot the server replies once for each recipient accepted by the `RCPT TO` command, in the same order.
+*/
+void lmtp::delivery_statuses(vector<recipient_status_t>& statuses)
+{
+    for (auto& rcpt : statuses)
+    {
+        if (!rcpt.accepted())
+            continue;
+
+        string line = dlg_->receive();
+        tuple<int, bool, string> tokens = parse_line(line);
+        while (!std::get<1>(tokens))
+        {
+            line = dlg_->receive();
+            tokens = parse_line(line);
+        }
+        rcpt.status = std::get<0>(tokens);
+        rcpt.response = std::get<2>(tokens);
+    }
+}
+
+
+void lmtp::ehlo()
+{
+    tuple<int, bool, string> tokens = hello("LHLO");
+    if (!positive_completion(std::get<0>(tokens)))
+        throw smtp_error("Initial message rejection.", std::get<2>(tokens));
+}
+
+
 smtp_error::smtp_error(const string& msg, const string& details) : dialog_error(msg, details)
 {
 }
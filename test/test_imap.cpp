@@ -0,0 +1,175 @@
+/*
+
+test_imap.cpp
+-------------
+
+Copyright (C) 2016, Tomislav Karastojkovic (http://www.alepho.com).
+
+Distributed under the FreeBSD license, see the accompanying file LICENSE or
+copy at http://www.freebsd.org/copyright/freebsd-license.html.
+
+*/
+
+
+#define BOOST_TEST_MODULE imap_test
+
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <mailio/imap.hpp>
+
+
+using std::string;
+using std::vector;
+using mailio::imap_error;
+using messages_set_t = mailio::imap::messages_set_t;
+
+
+/**
+Inserting the single IDs and the intervals, which are merged when adjacent or overlapping.
+
+@pre  None.
+@post None.
+**/
+BOOST_AUTO_TEST_CASE(insert_messages_set)
+{
+    messages_set_t ids;
+    BOOST_CHECK(ids.empty());
+    BOOST_CHECK(ids.to_string().empty());
+
+    ids.insert(5);
+    ids.insert(7);
+    BOOST_CHECK(ids.to_string() == "5,7");
+    ids.insert(6);
+    BOOST_CHECK(ids.to_string() == "5:7");
+    BOOST_CHECK(ids.intervals().size() == 1);
+
+    ids.insert(12, 10);
+    BOOST_CHECK(ids.to_string() == "5:7,10:12");
+    ids.insert(8, 9);
+    BOOST_CHECK(ids.to_string() == "5:12");
+    ids.insert(1, 3);
+    ids.insert(20, 25);
+    ids.insert(2, 21);
+    BOOST_CHECK(ids.to_string() == "1:25");
+
+    ids.insert(30);
+    BOOST_CHECK(ids.contains(1));
+    BOOST_CHECK(ids.contains(25));
+    BOOST_CHECK(!ids.contains(26));
+    BOOST_CHECK(ids.contains(30));
+    BOOST_CHECK(ids.size() == 26);
+    BOOST_CHECK((vector<unsigned long>(ids.begin(), ids.end()).back() == 30));
+
+    messages_set_t ranges{{3, 4}, {1, 2}, {9, std::nullopt}};
+    BOOST_CHECK(ranges.to_string() == "1:4,9:*");
+}
+
+
+/**
+Uniting, intersecting and subtracting the sets, with the intervals overlapping and touching each other.
+
+@pre  None.
+@post None.
+**/
+BOOST_AUTO_TEST_CASE(operate_messages_set)
+{
+    messages_set_t ids = messages_set_t::from_string("1:5,10:15,20");
+    ids |= messages_set_t::from_string("6,16:19,30");
+    BOOST_CHECK(ids.to_string() == "1:6,10:20,30");
+
+    messages_set_t common = messages_set_t::from_string("1:10,12,14:40");
+    common &= messages_set_t::from_string("3:4,8:13,15,25:*");
+    BOOST_CHECK(common.to_string() == "3:4,8:10,12,15,25:40");
+    BOOST_CHECK((messages_set_t::from_string("1:3") & messages_set_t::from_string("4:6")).empty());
+
+    messages_set_t remaining = messages_set_t::from_string("1:20,25:30");
+    remaining -= messages_set_t::from_string("1,5:6,10:26,29");
+    BOOST_CHECK(remaining.to_string() == "2:4,7:9,27:28,30");
+    BOOST_CHECK((messages_set_t::from_string("5:10") - messages_set_t::from_string("1:*")).empty());
+    BOOST_CHECK((messages_set_t::from_string("5:*") - messages_set_t::from_string("7:*")).to_string() == "5:6");
+
+    BOOST_CHECK((ids | common) == (common | ids));
+    BOOST_CHECK((ids - common) != ids);
+}
+
+
+/**
+Parsing the sequence sets, with the ranges in either order and the `*` character, and failing on the malformed ones.
+
+@pre  None.
+@post None.
+**/
+BOOST_AUTO_TEST_CASE(parse_messages_set)
+{
+    BOOST_CHECK(messages_set_t::from_string("").empty());
+    BOOST_CHECK(messages_set_t::from_string("7").to_string() == "7");
+    BOOST_CHECK(messages_set_t::from_string("4:2,5,9:*").to_string() == "2:5,9:*");
+    BOOST_CHECK(messages_set_t::from_string("*:3").to_string() == "3:*");
+    BOOST_CHECK(messages_set_t::from_string("*").intervals().begin()->first == messages_set_t::LAST_ID);
+
+    BOOST_CHECK_THROW(messages_set_t::from_string("1,,2"), imap_error);
+    BOOST_CHECK_THROW(messages_set_t::from_string("1:"), imap_error);
+    BOOST_CHECK_THROW(messages_set_t::from_string("1,"), imap_error);
+    BOOST_CHECK_THROW(messages_set_t::from_string("a"), imap_error);
+    BOOST_CHECK_THROW(messages_set_t::from_string("-1"), imap_error);
+    BOOST_CHECK_THROW(messages_set_t::from_string("3x"), imap_error);
+}
+
+
+/**
+Splitting the formatted set into the sequence sets not longer than the given length, except a single interval longer than it.
+
+@pre  None.
+@post None.
+**/
+BOOST_AUTO_TEST_CASE(split_messages_set)
+{
+    messages_set_t ids;
+    for (unsigned long id = 1; id <= 1000; id += 2)
+        ids.insert(id);
+
+    vector<string> sequence_sets = ids.to_strings(100);
+    BOOST_CHECK(sequence_sets.size() > 1);
+    messages_set_t joined;
+    for (const auto& sequence_set : sequence_sets)
+    {
+        BOOST_CHECK(sequence_set.length() <= 100);
+        joined |= messages_set_t::from_string(sequence_set);
+    }
+    BOOST_CHECK(joined == ids);
+    BOOST_CHECK(ids.to_strings(string::npos).size() == 1);
+
+    BOOST_CHECK((messages_set_t::from_string("100000:200000,7").to_strings(5) == vector<string>{"7", "100000:200000"}));
+    BOOST_CHECK(messages_set_t().to_strings(10).empty());
+}
+
+
+/**
+Keeping the `*` character in the open sets, which cannot be counted or iterated.
+
+@pre  None.
+@post None.
+**/
+BOOST_AUTO_TEST_CASE(open_messages_set)
+{
+    messages_set_t ids = messages_set_t::from_string("1:3,10:*");
+    BOOST_CHECK(!ids.closed());
+    BOOST_CHECK(ids.contains(messages_set_t::LAST_ID));
+    BOOST_CHECK(ids.to_string() == "1:3,10:*");
+    BOOST_CHECK_THROW(ids.size(), imap_error);
+    BOOST_CHECK_THROW(ids.begin(), imap_error);
+
+    ids.insert(4, 9);
+    BOOST_CHECK(ids.to_string() == "1:*");
+    ids -= messages_set_t::from_string("*");
+    BOOST_CHECK(ids.closed());
+    BOOST_CHECK(ids.to_string() == "1:" + std::to_string(messages_set_t::LAST_ID - 1));
+
+    messages_set_t closed_ids = messages_set_t::from_string("2,4:5");
+    BOOST_CHECK(closed_ids.closed());
+    BOOST_CHECK(closed_ids.size() == 3);
+    BOOST_CHECK((vector<unsigned long>(closed_ids.begin(), closed_ids.end()) == vector<unsigned long>{2, 4, 5}));
+    BOOST_CHECK(messages_set_t().closed());
+    BOOST_CHECK(messages_set_t().size() == 0);
+}